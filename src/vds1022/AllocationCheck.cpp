@@ -0,0 +1,319 @@
+// Standalone check that the frame path of the bridge doesn't allocate once
+// warmed up. Every heap allocation of the process is counted while armed, by
+// replacing the global operator new, which is why this is an executable of
+// its own rather than an option of the bridge. Only what goes through new is
+// seen, not malloc() calls from C libraries.
+//
+// The bridge is run on a capture file, or on a synthetic one made here when
+// none is given, so no device is needed.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "BufferPool.h"
+#include "CaptureFile.h"
+#include "NetStructs.h"
+#include "OWONSCPIServer.h"
+#include "VDS1022.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "../../lib/log/log.h"
+
+// Constant initialized, so usable by allocations made before main()
+static std::atomic<bool> armed(false);
+static std::atomic<uint64_t> allocations(0);
+static std::atomic<uint64_t> allocated_bytes(0);
+
+static void* allocate(std::size_t size)
+{
+	if(armed.load(std::memory_order_relaxed))
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	return std::malloc(size > 0 ? size : 1);
+}
+
+void* operator new(std::size_t size)
+{
+	void* p = allocate(size);
+	if(p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+static void arm()
+{
+	allocations = 0;
+	allocated_bytes = 0;
+	armed = true;
+}
+
+#ifndef _WIN32
+
+static bool recv_all(int fd, void* buf, size_t len)
+{
+	uint8_t* p = static_cast<uint8_t*>(buf);
+	while(len > 0)
+	{
+		ssize_t r = recv(fd, p, len, 0);
+		if(r <= 0)
+		{
+			return false;
+		}
+		p += r;
+		len -= static_cast<size_t>(r);
+	}
+	return true;
+}
+
+// Runs the bridge on a capture file, from the acquisition thread to the
+// waveform socket, and fails if anything is allocated once warm_up packets
+// were sent
+static bool run_allocation_check(const std::string& capture_path, size_t warm_up)
+{
+	VDS1022 scope;
+	if(!scope.open_replay(capture_path, false))
+	{
+		LogError("Unable to open %s for replay\n", capture_path.c_str());
+		return false;
+	}
+
+	// Stands for the client, reading the waveform socket as fast as it can
+	int scpi_fds[2];
+	int waveform_fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, scpi_fds) != 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, waveform_fds) != 0)
+	{
+		LogError("Unable to create sockets\n");
+		return false;
+	}
+
+	std::atomic<size_t> packets(0);
+	std::thread client([&]()
+	{
+		static uint8_t discard[65536];
+		OWONNetHeader hdr;
+		while(recv_all(waveform_fds[1], &hdr, sizeof(hdr)))
+		{
+			size_t left = hdr.size;
+			while(left > 0)
+			{
+				size_t chunk = left < sizeof(discard) ? left : sizeof(discard);
+				if(!recv_all(waveform_fds[1], discard, chunk))
+				{
+					return;
+				}
+				left -= chunk;
+			}
+
+			if(++packets == warm_up)
+			{
+				arm();
+			}
+		}
+	});
+
+	{
+		OWONSCPIServer server(scpi_fds[0], Socket(waveform_fds[0], AF_UNIX), &scope);
+		while(!scope.is_replay_done())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		// Everything read must be through the pipeline and on the socket
+		scope.stop();
+		armed = false;
+	}
+
+	// Done once the server closed its end
+	client.join();
+	close(waveform_fds[1]);
+	close(scpi_fds[1]);
+
+	if(packets <= warm_up)
+	{
+		LogError("%s is too short, only %zu packets for a warm up of %zu\n", capture_path.c_str(), packets.load(), warm_up);
+		return false;
+	}
+
+	uint64_t count = allocations;
+	printf("alloc-check %s: %zu packets after warm up, %llu allocations (%llu bytes): %s\n",
+		capture_path.c_str(), packets - warm_up, static_cast<unsigned long long>(count),
+		static_cast<unsigned long long>(allocated_bytes.load()), count == 0 ? "PASS" : "FAIL");
+	return count == 0;
+}
+
+// Triggered frames of a sine on CH1 and a square on CH2, both drifting a bit
+// from one frame to the next so that nothing downstream sees the same frame twice
+static bool write_synthetic_capture(const std::string& path, size_t num_frames)
+{
+	CaptureWriter writer;
+	if(!writer.open(path))
+	{
+		return false;
+	}
+
+	CaptureConfig config{};
+	config.sample_rate = 1000000;
+	config.ranges[0] = static_cast<uint8_t>(Driver::find_range(1.0));
+	config.ranges[1] = config.ranges[0];
+	if(!writer.append_config(config, 0))
+	{
+		return false;
+	}
+
+	static uint8_t raw[DATA_BLOCK_SIZE * 2];
+	for(size_t frame = 0; frame < num_frames; frame++)
+	{
+		for(uint8_t ch = 0; ch < 2; ch++)
+		{
+			// Same layout as the reply to CMD_GET_DATA, see Driver::decode_data()
+			uint8_t* block = raw + ch * DATA_BLOCK_SIZE;
+			std::memset(block, 0, 111);
+			block[0] = ch;
+			block[9] = static_cast<uint8_t>(frame);
+			for(size_t i = 0; i < 5100; i++)
+			{
+				double phase = 2.0 * M_PI * (i + frame % 50) / 500.0;
+				double value = ch == 0 ? 80.0 * sin(phase) : (sin(phase) >= 0 ? 60.0 : -60.0);
+				block[111 + i] = static_cast<uint8_t>(static_cast<int8_t>(value + (frame % 3) - 1));
+			}
+		}
+		if(!writer.append_frame(raw, sizeof(raw), false, frame * 1000000ull))
+		{
+			return false;
+		}
+	}
+	writer.close();
+	return true;
+}
+
+#endif
+
+static void help()
+{
+	fprintf(stderr,
+			"vds1022-alloc-check [options] [capture file]\n"
+			"\n"
+			"  Runs the bridge on the capture file (or a synthetic one) and fails if the frame\n"
+			"  path allocates anything once warmed up.\n"
+			"\n"
+			"    --warm-up <packets>           : packets sent before allocations count, default 200\n"
+			"    --hugepages                   : back frame and transfer buffers with 2 MB hugepages\n"
+			"\n"
+			"  [logger options]:\n"
+			"    --quiet|-q                    : reduce logging level by one step\n"
+			"    --verbose                     : set logging level to VERBOSE\n"
+			"    --debug                       : set logging level to DEBUG\n"
+	);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string capture_path;
+	size_t warm_up = 200;
+
+	Severity console_verbosity = Severity::NOTICE;
+	for(int i = 1; i < argc; i++)
+	{
+		std::string s(argv[i]);
+
+		if(ParseLoggerArguments(i, argc, argv, console_verbosity))
+			continue;
+
+		if(s == "--help")
+		{
+			help();
+			return 0;
+		}
+		else if(s == "--warm-up" && i + 1 < argc)
+		{
+			warm_up = strtoul(argv[++i], nullptr, 10);
+		}
+		else if(s == "--hugepages")
+		{
+			BufferPool::use_huge_pages(true);
+		}
+		else if(s[0] != '-' && capture_path.empty())
+		{
+			capture_path = s;
+		}
+		else
+		{
+			fprintf(stderr, "Unrecognized command-line argument \"%s\", use --help\n", s.c_str());
+			return -1;
+		}
+	}
+
+	g_log_sinks.emplace(g_log_sinks.begin(), new STDLogSink(console_verbosity));
+
+#ifndef _WIN32
+	if(!capture_path.empty())
+	{
+		return run_allocation_check(capture_path, warm_up) ? 0 : 1;
+	}
+
+	char path[] = "/tmp/vds1022-alloc-check-XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0)
+	{
+		LogError("Unable to create a temporary capture file\n");
+		return 1;
+	}
+	close(fd);
+
+	// Two waveform packets per frame at the least
+	bool ok = write_synthetic_capture(path, warm_up + 1000);
+	if(!ok)
+	{
+		LogError("Unable to write the synthetic capture %s\n", path);
+	}
+	else
+	{
+		ok = run_allocation_check(path, warm_up);
+	}
+	unlink(path);
+	return ok ? 0 : 1;
+#else
+	LogError("The allocation check is not supported on Windows\n");
+	return 1;
+#endif
+}
@@ -0,0 +1,142 @@
+#include "Autoset.h"
+
+#include <cstdlib>
+
+#include "FrequencyCounter.h"
+
+// Codes from the center to the edge of the screen
+static const int HALF_SCALE_CODES = static_cast<int>(ADC_CODES_PER_RANGE / 2);
+// At or past this, the signal may go beyond what the ADC can show
+static const int CLIP_CODES = HALF_SCALE_CODES - 1;
+// Below this, quantization makes the amplitude too rough to pick a range from
+static const int MIN_CODES = 8;
+// Samples of a record, without the pre and post trigger margins
+static const double RECORD_SAMPLES = 5000.0;
+
+static int peak_codes(const AcquiredData& data)
+{
+	int peak = 0;
+	for(uint8_t sample : data.samples)
+	{
+		int code = std::abs(static_cast<int>(static_cast<int8_t>(sample)));
+		if(code > peak)
+		{
+			peak = code;
+		}
+	}
+	return peak;
+}
+
+Autoset::Autoset()
+:	frequency(0.0)
+{
+	start();
+}
+
+void Autoset::start()
+{
+	for(auto& chan : channels)
+	{
+		chan.lo = 0;
+		chan.hi = Driver::NUM_RANGES - 1;
+		chan.range = (chan.lo + chan.hi) / 2;
+		chan.settled = false;
+	}
+	frequency = 0.0;
+}
+
+void Autoset::step(Channel& chan, const AcquiredData& data)
+{
+	int peak = peak_codes(data);
+
+	if(peak >= CLIP_CODES)
+	{
+		// Only bigger ranges are left
+		if(chan.range >= chan.hi)
+		{
+			chan.settled = true;
+			return;
+		}
+		chan.lo = chan.range + 1;
+		chan.range = (chan.lo + chan.hi) / 2;
+		return;
+	}
+
+	if(peak < MIN_CODES)
+	{
+		if(chan.range <= chan.lo)
+		{
+			chan.settled = true;
+			return;
+		}
+		chan.hi = chan.range - 1;
+		chan.range = (chan.lo + chan.hi) / 2;
+		return;
+	}
+
+	// Measurable, the amplitude tells the range directly
+	double codes_per_div = ADC_CODES_PER_RANGE / Driver::NUM_DIVISIONS;
+	double amplitude = peak * Driver::RANGE_VOLTS_DIV[chan.range] / codes_per_div;
+	double fill_divs = TARGET_FILL * HALF_SCALE_CODES / codes_per_div;
+	size_t target = Driver::find_range(amplitude / fill_divs);
+	if(target < chan.lo)
+	{
+		target = chan.lo;
+	}
+
+	// A bigger range would only make it smaller on screen, as it doesn't clip here
+	if(target >= chan.range)
+	{
+		chan.settled = true;
+		return;
+	}
+
+	// Still fine with this range if the estimate was off, so keep it as the upper bound
+	chan.hi = chan.range;
+	chan.range = target;
+}
+
+bool Autoset::push_frame(const AcquiredData* ch1, const AcquiredData* ch2)
+{
+	const AcquiredData* data[2] = {ch1, ch2};
+	for(int ch = 0; ch < 2; ch++)
+	{
+		if(data[ch] == nullptr || channels[ch].settled)
+		{
+			continue;
+		}
+		step(channels[ch], *data[ch]);
+	}
+
+	// The counters of the latest frame are the ones taken with the best ranges so far
+	frequency = 0.0;
+	for(auto d : data)
+	{
+		if(d != nullptr && d->time_sum != 0 && d->period_num != 0)
+		{
+			frequency = FrequencyCounter::CLOCK_HZ * d->period_num / d->time_sum;
+			break;
+		}
+	}
+
+	return is_settled();
+}
+
+int32_t Autoset::get_sample_rate(int32_t current_rate) const
+{
+	if(frequency <= 0.0)
+	{
+		return current_rate;
+	}
+
+	double ideal = frequency * RECORD_SAMPLES / TARGET_PERIODS;
+	int32_t rate = Driver::SAMPLE_RATES[0];
+	for(int32_t r : Driver::SAMPLE_RATES)
+	{
+		if(r <= ideal)
+		{
+			rate = r;
+		}
+	}
+	return rate;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "Driver.h"
+
+// Picks the volts/div of both channels and the timebase from as few
+// acquisitions as possible. Ranges are binary searched over the calibrated
+// ones, except that an acquisition which neither clips nor drowns in the
+// quantization tells the amplitude, and so the right range, straight away.
+// The timebase comes from the hardware frequency counters of the last frame,
+// which need no particular sample rate.
+//
+// Only decides, the caller does the acquisitions: set get_range() on the
+// device, acquire, push_frame(), until settled.
+class Autoset
+{
+public:
+	// Peak to clip ratio aimed for, so the trace stays clear of the edges
+	static constexpr double TARGET_FILL = 0.8;
+	// Periods to show over the record
+	static constexpr double TARGET_PERIODS = 4.0;
+	// Block mode rate the acquisitions are made at: a record covers a mains
+	// period, and max acquisitions of them fit well within the deadline
+	static constexpr int32_t SEARCH_RATE = 250000;
+
+	Autoset();
+
+	void start();
+
+	size_t get_range(uint8_t ch) const { return channels[ch].range; }
+	bool is_settled() const { return channels[0].settled && channels[1].settled; }
+
+	// Data acquired with the current ranges, nullptr for a channel that wasn't.
+	// Returns true once both channels are settled.
+	bool push_frame(const AcquiredData* ch1, const AcquiredData* ch2);
+
+	// 0 if no whole period was seen on either channel
+	double get_frequency() const { return frequency; }
+	// Fastest rate with TARGET_PERIODS in the record, current_rate if the
+	// frequency is unknown
+	int32_t get_sample_rate(int32_t current_rate) const;
+
+protected:
+
+	struct Channel
+	{
+		size_t lo;
+		size_t hi;
+		size_t range;
+		bool settled;
+	};
+
+	void step(Channel& chan, const AcquiredData& data);
+
+	Channel channels[2];
+	double frequency;
+};
@@ -0,0 +1,131 @@
+#include "Averager.h"
+
+#include <algorithm>
+
+Averager::Averager()
+:	mode(OFF)
+,	count(1)
+,	shift(0)
+,	frames(0)
+,	result_frames(0)
+{
+}
+
+void Averager::configure(Mode _mode, uint32_t _count)
+{
+	mode = _mode;
+	count = _count < 1 ? 1 : (_count > MAX_COUNT ? MAX_COUNT : _count);
+
+	shift = 0;
+	while((2u << shift) <= count)
+	{
+		shift++;
+	}
+	if(mode == EXPONENTIAL)
+	{
+		count = 1u << shift;
+	}
+
+	// 255 * 257 still fits in 16 bits
+	bool narrow = mode == BLOCK && count <= 257;
+	acc16.assign(mode == BLOCK && narrow ? NUM_SAMPLES : 0, 0);
+	acc32.assign(mode == BLOCK && !narrow ? NUM_SAMPLES : 0, 0);
+	acc_exp.assign(mode == EXPONENTIAL ? NUM_SAMPLES : 0, 0);
+	result.assign(NUM_SAMPLES, 0);
+
+	reset();
+}
+
+void Averager::reset()
+{
+	std::fill(acc16.begin(), acc16.end(), 0);
+	std::fill(acc32.begin(), acc32.end(), 0);
+	frames = 0;
+	result_frames = 0;
+}
+
+bool Averager::push_frame(const AcquiredData& data)
+{
+	// Skip the 50 pre samples. Codes are flipped to unsigned (offset by 128)
+	// so the accumulators can be unsigned
+	const uint8_t* samples = data.samples.data() + 50;
+
+	if(mode == BLOCK)
+	{
+		if(!acc16.empty())
+		{
+			uint16_t* acc = acc16.data();
+			for(size_t i = 0; i < NUM_SAMPLES; i++)
+			{
+				acc[i] += static_cast<uint8_t>(samples[i] ^ 0x80);
+			}
+		}
+		else
+		{
+			uint32_t* acc = acc32.data();
+			for(size_t i = 0; i < NUM_SAMPLES; i++)
+			{
+				acc[i] += static_cast<uint8_t>(samples[i] ^ 0x80);
+			}
+		}
+
+		if(++frames < count)
+		{
+			return false;
+		}
+
+		// Block is complete, keep the result and start over
+		for(size_t i = 0; i < NUM_SAMPLES; i++)
+		{
+			uint32_t sum = acc16.empty() ? acc32[i] : acc16[i];
+			result[i] = static_cast<int16_t>(static_cast<int32_t>((static_cast<uint64_t>(sum) << 8) / count) - 32768);
+		}
+		reset();
+		result_frames = count;
+		return true;
+	}
+	else if(mode == EXPONENTIAL)
+	{
+		int32_t* acc = acc_exp.data();
+		if(frames == 0)
+		{
+			// Start from the first frame instead of ramping up from zero
+			for(size_t i = 0; i < NUM_SAMPLES; i++)
+			{
+				acc[i] = static_cast<int32_t>(static_cast<uint8_t>(samples[i] ^ 0x80)) << 16;
+			}
+		}
+		else
+		{
+			for(size_t i = 0; i < NUM_SAMPLES; i++)
+			{
+				int32_t x = static_cast<int32_t>(static_cast<uint8_t>(samples[i] ^ 0x80)) << 16;
+				acc[i] += (x - acc[i]) >> shift;
+			}
+		}
+
+		if(frames < count)
+		{
+			frames++;
+		}
+		result_frames = frames;
+		return true;
+	}
+
+	return false;
+}
+
+void Averager::get_result(int16_t* out) const
+{
+	if(mode == EXPONENTIAL)
+	{
+		for(size_t i = 0; i < NUM_SAMPLES; i++)
+		{
+			out[i] = static_cast<int16_t>((acc_exp[i] >> 8) - 32768);
+		}
+	}
+	else
+	{
+		std::copy(result.begin(), result.end(), out);
+	}
+}
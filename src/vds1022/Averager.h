@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Driver.h"
+
+// Averages frames on the bridge so only the result has to be sent, with
+// 8 extra bits of resolution.
+//
+// Block averaging sums N frames (uint16 accumulators while the sum can't
+// overflow them, uint32 otherwise) and produces one result every N frames.
+// Exponential averaging keeps a 16.16 fixed point running average with a
+// weight of 1/N for new frames, N being rounded down to a power of two so
+// it's a shift.
+class Averager
+{
+public:
+	enum Mode
+	{
+		OFF,
+		BLOCK,
+		EXPONENTIAL,
+	};
+
+	static constexpr uint32_t MAX_COUNT = 65536;
+	static const size_t NUM_SAMPLES = 5000;
+
+	Averager();
+
+	// Also clears the accumulators
+	void configure(Mode mode, uint32_t count);
+	void reset();
+
+	Mode get_mode() const { return mode; }
+	uint32_t get_count() const { return count; }
+
+	// Returns true when a new result is ready
+	bool push_frame(const AcquiredData& data);
+
+	// Number of frames in the current result
+	uint32_t get_frames() const { return result_frames; }
+
+	// Result in 1/256 of an ADC code
+	void get_result(int16_t* out) const;
+
+protected:
+
+	Mode mode;
+	uint32_t count;
+	uint32_t shift;
+	uint32_t frames;
+	uint32_t result_frames;
+
+	std::vector<uint16_t> acc16;
+	std::vector<uint32_t> acc32;
+	std::vector<int32_t> acc_exp;
+	// Block result, kept once complete while the next block accumulates
+	std::vector<int16_t> result;
+};
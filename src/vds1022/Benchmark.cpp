@@ -0,0 +1,352 @@
+#include "Benchmark.h"
+
+#include <log.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ChannelFilter.h"
+#include "DeadTimeAnalyzer.h"
+#include "Driver.h"
+#include "FramePipeline.h"
+#include "MeasurementEngine.h"
+#include "PersistenceHistogram.h"
+#include "ScpiCommands.h"
+#include "SpectrumAnalyzer.h"
+#include "TaskPool.h"
+#include "VDS1022.h"
+
+using Clock = std::chrono::steady_clock;
+
+// A sine with some harmonics and noise, as a typical frame
+static void fill_frame(AcquiredData& data, unsigned int seed)
+{
+	data.time_sum = 100000000;
+	data.period_num = 1000;
+	data.cursor = 2550;
+	for(size_t i = 0; i < data.samples.size(); i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		double v = 80.0 * std::sin(i * 0.05) + 10.0 * std::sin(i * 0.15) + ((seed >> 16) % 9) - 4.0;
+		data.samples[i] = static_cast<uint8_t>(static_cast<int8_t>(std::lround(v)));
+	}
+	for(size_t i = 0; i < data.trigger_buf.size(); i++)
+	{
+		data.trigger_buf[i] = static_cast<uint8_t>(static_cast<int8_t>(i) - 50);
+	}
+}
+
+static double elapsed_us(Clock::time_point start, size_t iterations)
+{
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / iterations;
+}
+
+static void benchmark_fft()
+{
+	const size_t iterations = 5000;
+	AcquiredData frame;
+	fill_frame(frame, 1);
+
+	static const char* names[] = {"rectangular", "hann", "blackman-harris", "flat-top"};
+	for(int w = SpectrumAnalyzer::RECTANGULAR; w <= SpectrumAnalyzer::FLAT_TOP; w++)
+	{
+		SpectrumAnalyzer analyzer;
+		analyzer.configure(static_cast<SpectrumAnalyzer::Window>(w), 1);
+
+		auto start = Clock::now();
+		for(size_t i = 0; i < iterations; i++)
+		{
+			analyzer.push_frame(frame);
+		}
+		printf("fft %-16s %zu point frame, %zu point fft: %8.2f us/frame\n",
+			names[w], SpectrumAnalyzer::NUM_SAMPLES, analyzer.get_fft_size(), elapsed_us(start, iterations));
+	}
+}
+
+// A device worth of processing, as the bridge does in its heavier modes:
+// filtering, then measurements, FFT and persistence side by side
+struct PipelineDevice
+{
+	explicit PipelineDevice(TaskPool& pool)
+	:	pipeline(8, &pool)
+	{
+		for(uint8_t ch = 0; ch < 2; ch++)
+		{
+			filters[ch].configure(ChannelFilter::FIR_LOWPASS, 1e5, 63, 1e6);
+			spectrum[ch].configure(SpectrumAnalyzer::HANN, 1);
+			persistence[ch].configure(1000, false, 0);
+		}
+
+		size_t filter = pipeline.add_stage("filter", [this](PipelineFrame& f, uint8_t ch)
+		{
+			filters[ch].reset();
+			filters[ch].process(f.data[ch].samples.data(), f.data[ch].samples.size());
+		}, {}, true);
+
+		// Measuring a single frame needs no state, so frames may be measured out of order
+		pipeline.add_stage("measure", [](PipelineFrame& f, uint8_t ch)
+		{
+			f.measurements[ch] = MeasurementEngine::measure(reinterpret_cast<const int8_t*>(f.data[ch].samples.data()),
+				f.data[ch].samples.size(), 1e6);
+		}, {filter}, false);
+
+		pipeline.add_stage("fft", [this](PipelineFrame& f, uint8_t ch)
+		{
+			spectrum[ch].push_frame(f.data[ch]);
+		}, {filter}, true);
+
+		pipeline.add_stage("persist", [this](PipelineFrame& f, uint8_t ch)
+		{
+			persistence[ch].push_frame(f.data[ch]);
+		}, {filter}, true);
+	}
+
+	ChannelFilter filters[2];
+	SpectrumAnalyzer spectrum[2];
+	PersistenceHistogram persistence[2];
+	FramePipeline pipeline;
+};
+
+static void benchmark_pipeline()
+{
+	const size_t frames_per_device = 2000;
+	const size_t num_devices = 2;
+	AcquiredData frame;
+	fill_frame(frame, 1);
+
+	size_t max_workers = std::thread::hardware_concurrency();
+	std::vector<size_t> worker_counts;
+	for(size_t workers = 1; workers < max_workers; workers *= 2)
+	{
+		worker_counts.push_back(workers);
+	}
+	worker_counts.push_back(max_workers > 0 ? max_workers : 1);
+
+	double single = 0;
+	for(size_t workers : worker_counts)
+	{
+		TaskPool pool(workers);
+		std::vector<std::unique_ptr<PipelineDevice>> devices;
+		for(size_t i = 0; i < num_devices; i++)
+		{
+			devices.emplace_back(new PipelineDevice(pool));
+		}
+
+		// One acquisition thread per device, as with real scopes
+		auto start = Clock::now();
+		std::vector<std::thread> producers;
+		for(auto& device : devices)
+		{
+			FramePipeline* pipeline = &device->pipeline;
+			producers.emplace_back([pipeline, &frame]()
+			{
+				for(size_t i = 0; i < frames_per_device; i++)
+				{
+					PipelineFrame* f = pipeline->acquire();
+					f->data[0] = frame;
+					f->data[1] = frame;
+					f->has_ch[0] = true;
+					f->has_ch[1] = true;
+					f->roll = false;
+					f->generation = 0;
+					f->sample_rate = 1000000;
+					f->read_time = Clock::now();
+					pipeline->submit(f);
+				}
+				pipeline->flush();
+			});
+		}
+		for(auto& producer : producers)
+		{
+			producer.join();
+		}
+
+		double us = elapsed_us(start, frames_per_device * num_devices);
+		if(single == 0)
+		{
+			single = us;
+		}
+		printf("pipeline %2zu workers, %zu devices x 2 channels: %8.2f us/frame, %7.0f frames/s, %5.2fx, %5.1f%% stolen\n",
+			workers, num_devices, us, 1e6 / us, single / us,
+			pool.get_executed() > 0 ? 100.0 * pool.get_stolen() / pool.get_executed() : 0.0);
+	}
+}
+
+// Dispatch as the if / else chains did it: every command compared in turn
+static ScpiCommand find_scpi_command_linear(const std::string& subject, const std::string& cmd, size_t& chan)
+{
+	std::string subj = subject;
+	if(subject == "C1" || subject == "C2")
+	{
+		chan = subject[1] - '1';
+		subj = "C";
+	}
+	for(int c = SCPI_UNKNOWN + 1; c < SCPI_NUM_COMMANDS; c++)
+	{
+		if(subj == SCPI_COMMAND_NAMES[c].subject && cmd == SCPI_COMMAND_NAMES[c].cmd)
+		{
+			return static_cast<ScpiCommand>(c);
+		}
+	}
+	return SCPI_UNKNOWN;
+}
+
+static void benchmark_scpi()
+{
+	const size_t iterations = 2000000;
+
+	// A typical automation mix, with some commands handled by the base server
+	static const char* lines[][2] =
+	{
+		{"C1", "FREQ"}, {"C2", "VPP"}, {"AVG", "COUNT"}, {"ETS", "RESET"}, {"C1", "MASKSTATS"},
+		{"SCHED", "LATENCY"}, {"", "ROLL"}, {"C2", "CROSSINGS"}, {"", "RATE"}, {"C1", "RANGE"},
+	};
+	const size_t num_lines = sizeof(lines) / sizeof(lines[0]);
+	std::vector<std::string> subjects;
+	std::vector<std::string> cmds;
+	for(auto& line : lines)
+	{
+		subjects.push_back(line[0]);
+		cmds.push_back(line[1]);
+	}
+
+	typedef ScpiCommand (*Lookup)(const std::string&, const std::string&, size_t&);
+	static const Lookup lookups[] = {find_scpi_command_linear, find_scpi_command};
+	static const char* names[] = {"string compares", "perfect hash"};
+	double first = 0;
+	for(int l = 0; l < 2; l++)
+	{
+		size_t found = 0;
+		auto start = Clock::now();
+		for(size_t i = 0; i < iterations; i++)
+		{
+			size_t chan = 0;
+			found += lookups[l](subjects[i % num_lines], cmds[i % num_lines], chan) != SCPI_UNKNOWN;
+		}
+		double us = elapsed_us(start, iterations);
+		if(first == 0)
+		{
+			first = us;
+		}
+		printf("scpi %-16s %zu commands: %8.1f ns/command, %6.2f M commands/s, %5.2fx (%zu found)\n",
+			names[l], static_cast<size_t>(SCPI_NUM_COMMANDS - 1), us * 1000, 1 / us, first / us, found);
+	}
+}
+
+// Same processing as above, on frames recorded from a real device
+static bool benchmark_replay(const std::string& path)
+{
+	VDS1022 scope;
+	if(!scope.open_replay(path, false))
+	{
+		LogError("Unable to open %s for replay\n", path.c_str());
+		return false;
+	}
+
+	PipelineDevice device(TaskPool::get());
+	size_t frames = 0;
+	device.pipeline.set_deliver([&](PipelineFrame& f)
+	{
+		frames++;
+		device.pipeline.release(&f);
+	});
+
+	auto start = Clock::now();
+	scope.start(device.pipeline);
+	while(!scope.is_replay_done())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	scope.stop();
+
+	double us = elapsed_us(start, frames > 0 ? frames : 1);
+	printf("replay %s: %zu frames, %8.2f us/frame, %7.0f frames/s\n", path.c_str(), frames, us, 1e6 / us);
+	return true;
+}
+
+bool run_dead_time_sweep(VDS1022& scope, unsigned int ms_per_setting)
+{
+	if(!scope.start())
+	{
+		return false;
+	}
+
+	DeadTimeAnalyzer analyzer;
+	for(int peak = 0; peak < 2; peak++)
+	{
+		for(int32_t rate : Driver::SAMPLE_RATES)
+		{
+			// Roll mode has no records to be blind between
+			if(rate <= Driver::ROLL_MODE_MAX_RATE)
+			{
+				continue;
+			}
+			// Too few records in the time given to say anything
+			if(DeadTimeAnalyzer::RECORD_SAMPLES * 1000.0 / rate * 10 > ms_per_setting)
+			{
+				continue;
+			}
+
+			scope.set_sampling(rate, peak != 0, false);
+			uint32_t generation = scope.get_generation();
+			auto end = Clock::now() + std::chrono::milliseconds(ms_per_setting);
+			while(Clock::now() < end)
+			{
+				PipelineFrame* frame = scope.get_frame(10);
+				if(frame == nullptr)
+				{
+					continue;
+				}
+
+				// Frames still on their way from the previous setting don't count
+				if(frame->generation == generation && !frame->roll)
+				{
+					DeadTimeAnalyzer::Config config{};
+					config.sample_rate = static_cast<uint64_t>(rate);
+					config.channels = static_cast<uint8_t>((frame->has_ch[0] ? 1 : 0) | (frame->has_ch[1] ? 2 : 0));
+					config.peak_detect = peak != 0;
+					analyzer.add_frame(config, frame->generation, frame->times, Clock::now());
+				}
+				scope.release(frame);
+			}
+		}
+	}
+	scope.stop();
+
+	printf("dead time, %u ms per setting, trigger phases %s\n%s", ms_per_setting,
+		scope.is_phase_probing() ? "probed" : "not probed", analyzer.format_table().c_str());
+	return true;
+}
+
+bool run_benchmark(const std::string& name)
+{
+	bool all = name == "all";
+	bool found = false;
+
+	// Not part of all, as it needs a recording
+	if(name.compare(0, 7, "replay:") == 0)
+	{
+		return benchmark_replay(name.substr(7));
+	}
+
+	if(all || name == "fft")
+	{
+		benchmark_fft();
+		found = true;
+	}
+	if(all || name == "pipeline")
+	{
+		benchmark_pipeline();
+		found = true;
+	}
+	if(all || name == "scpi")
+	{
+		benchmark_scpi();
+		found = true;
+	}
+
+	return found;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <string>
+
+// Offline benchmarks of the processing stages, run on synthetic frames (or a
+// recording, with replay:<file>) so no device is needed. Prints its results
+// and returns false if name is unknown or the recording can't be opened.
+bool run_benchmark(const std::string& name);
+
+class VDS1022;
+
+// Goes through the sample rates and peak detect modes on an opened device
+// (not running yet), acquiring for ms_per_setting each, then prints the dead
+// time and waveform rate of each setting as a table. Returns false if
+// acquisition couldn't start.
+bool run_dead_time_sweep(VDS1022& scope, unsigned int ms_per_setting);
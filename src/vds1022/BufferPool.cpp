@@ -0,0 +1,104 @@
+#include "BufferPool.h"
+
+#include <log.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+std::atomic<bool> BufferPool::huge_pages(false);
+
+BufferPool::BufferPool(size_t size, size_t count)
+:	base(nullptr)
+,	block_size((size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT)
+,	num_blocks(count)
+,	mapped(0)
+,	huge(false)
+{
+	size_t total = block_size * num_blocks;
+	if(total == 0)
+	{
+		return;
+	}
+
+#ifdef __linux__
+	if(huge_pages)
+	{
+		size_t length = (total + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(p != MAP_FAILED)
+		{
+			huge = true;
+		}
+		else
+		{
+			// Nothing reserved, transparent hugepages are better than nothing
+			p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if(p != MAP_FAILED && madvise(p, length, MADV_HUGEPAGE) != 0)
+			{
+				LogWarning("No hugepages for a %zu KB pool: %s\n", length >> 10, strerror(errno));
+			}
+		}
+
+		if(p != MAP_FAILED)
+		{
+			base = static_cast<uint8_t*>(p);
+			mapped = length;
+		}
+	}
+#else
+	if(huge_pages)
+	{
+		LogWarning("Hugepages are only supported on Linux\n");
+	}
+#endif
+
+	if(base == nullptr)
+	{
+		void* p = nullptr;
+#ifdef _WIN32
+		p = _aligned_malloc(total, ALIGNMENT);
+#else
+		if(posix_memalign(&p, ALIGNMENT, total) != 0)
+		{
+			p = nullptr;
+		}
+#endif
+		if(p == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+		base = static_cast<uint8_t*>(p);
+	}
+
+	// Also faults every page in now rather than with the first frames
+	std::memset(base, 0, total);
+}
+
+BufferPool::~BufferPool()
+{
+	if(base == nullptr)
+	{
+		return;
+	}
+
+#ifdef __linux__
+	if(mapped > 0)
+	{
+		munmap(base, mapped);
+		return;
+	}
+#endif
+#ifdef _WIN32
+	_aligned_free(base);
+#else
+	free(base);
+#endif
+}
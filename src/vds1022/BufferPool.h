@@ -0,0 +1,44 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed size blocks allocated once, for buffers reused from one frame to the
+// next. Blocks are 64 byte (cache line) aligned, and the pool can be backed
+// by 2 MB hugepages so the frames of a pipeline take a few TLB entries.
+//
+// The memory is zeroed and touched when allocated, so it doesn't page fault
+// later (and is locked with the rest if ThreadPlacement::lock_memory() was
+// called). Objects must be constructed in the blocks by the owner.
+class BufferPool
+{
+public:
+	static const size_t ALIGNMENT = 64;
+	static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+	BufferPool(size_t block_size, size_t num_blocks);
+	~BufferPool();
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	// Whether pools created from now on try hugepages, reserved ones
+	// (vm.nr_hugepages) first then transparent ones. Only supported on Linux.
+	static void use_huge_pages(bool use) { huge_pages = use; }
+
+	void* get(size_t index) const { return base + index * block_size; }
+	size_t get_block_size() const { return block_size; }
+	size_t get_num_blocks() const { return num_blocks; }
+	bool is_huge() const { return huge; }
+
+protected:
+
+	uint8_t* base;
+	size_t block_size;
+	size_t num_blocks;
+	// Size of the mapping, 0 if allocated on the heap
+	size_t mapped;
+	bool huge;
+
+	static std::atomic<bool> huge_pages;
+};
@@ -0,0 +1,443 @@
+#include "CaptureFile.h"
+
+#include <log.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define CAPTURE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char FILE_MAGIC[8] = {'V', 'D', 'S', '1', '0', '2', '2', 'C'};
+static const char CHUNK_MAGIC[4] = {'C', 'H', 'N', 'K'};
+static const uint32_t FILE_VERSION = 2;
+
+// Offset of the samples in each channel's block, see Driver::decode_data
+static const size_t BLOCK_SAMPLES_OFFSET = 111;
+static const size_t BLOCK_SAMPLES = 5100;
+
+static uint64_t chunk_offset(uint64_t index, size_t chunk_size)
+{
+	return CAPTURE_HEADER_SIZE + index * chunk_size;
+}
+
+CaptureWriter::CaptureWriter()
+:	fd(-1)
+,	chunk_size(0)
+,	header(nullptr)
+,	chunk(nullptr)
+,	chunk_index(0)
+,	frames(0)
+,	bytes(0)
+{
+}
+
+CaptureWriter::~CaptureWriter()
+{
+	close();
+}
+
+#ifdef CAPTURE_MMAP
+
+bool CaptureWriter::open(const std::string& fpath, size_t fchunk_size)
+{
+	close();
+
+	chunk_size = (std::max<size_t>(fchunk_size, 1) + 0xFFFF) & ~static_cast<size_t>(0xFFFF);
+	fd = ::open(fpath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+	{
+		LogError("Could not create capture file %s: %s\n", fpath.c_str(), strerror(errno));
+		return false;
+	}
+
+	if(ftruncate(fd, CAPTURE_HEADER_SIZE) != 0)
+	{
+		LogError("Could not grow capture file %s: %s\n", fpath.c_str(), strerror(errno));
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+	void* map = mmap(nullptr, CAPTURE_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		LogError("Could not map capture file %s: %s\n", fpath.c_str(), strerror(errno));
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	header = static_cast<CaptureFileHeader*>(map);
+	memcpy(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+	header->version = FILE_VERSION;
+	header->chunk_size = static_cast<uint32_t>(chunk_size);
+	header->start_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	header->num_chunks = 0;
+	header->index_offset = 0;
+
+	path = fpath;
+	frames = 0;
+	bytes = CAPTURE_HEADER_SIZE;
+	if(!map_chunk(0))
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool CaptureWriter::map_chunk(uint64_t index)
+{
+	unmap_chunk();
+
+	uint64_t offset = chunk_offset(index, chunk_size);
+	if(ftruncate(fd, offset + chunk_size) != 0)
+	{
+		LogError("Could not grow capture file %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+	void* map = mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+	if(map == MAP_FAILED)
+	{
+		LogError("Could not map capture file %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	chunk = static_cast<uint8_t*>(map);
+	chunk_index = index;
+	// The file was grown with zeros, so the rest of the header already is
+	CaptureChunkHeader* chdr = reinterpret_cast<CaptureChunkHeader*>(chunk);
+	memcpy(chdr->magic, CHUNK_MAGIC, sizeof(CHUNK_MAGIC));
+	chdr->min[0] = chdr->min[1] = INT8_MAX;
+	chdr->max[0] = chdr->max[1] = INT8_MIN;
+	header->num_chunks = index + 1;
+	return true;
+}
+
+void CaptureWriter::unmap_chunk()
+{
+	if(chunk != nullptr)
+	{
+		munmap(chunk, chunk_size);
+		chunk = nullptr;
+	}
+}
+
+bool CaptureWriter::append(uint8_t type, bool roll, const uint8_t* payload, size_t size, uint64_t time_ns)
+{
+	if(fd < 0 || chunk == nullptr)
+	{
+		return false;
+	}
+
+	size_t needed = sizeof(CaptureRecordHeader) + size;
+	if(sizeof(CaptureChunkHeader) + needed > chunk_size)
+	{
+		LogError("Capture record of %zu bytes does not fit in a chunk\n", size);
+		return false;
+	}
+
+	CaptureChunkHeader* chdr = reinterpret_cast<CaptureChunkHeader*>(chunk);
+	if(sizeof(CaptureChunkHeader) + chdr->used + needed > chunk_size)
+	{
+		if(!map_chunk(chunk_index + 1))
+		{
+			return false;
+		}
+		chdr = reinterpret_cast<CaptureChunkHeader*>(chunk);
+	}
+
+	uint8_t* dst = chunk + sizeof(CaptureChunkHeader) + chdr->used;
+	CaptureRecordHeader rhdr{};
+	rhdr.type = type;
+	rhdr.roll = roll ? 1 : 0;
+	rhdr.size = static_cast<uint32_t>(size);
+	rhdr.time_ns = time_ns;
+	memcpy(dst, &rhdr, sizeof(rhdr));
+	memcpy(dst + sizeof(rhdr), payload, size);
+
+	// Only counted once the record is complete, so a crash never leaves half of one
+	if(chdr->num_records == 0)
+	{
+		chdr->first_ns = time_ns;
+	}
+	chdr->last_ns = time_ns;
+	chdr->num_records++;
+	chdr->used += static_cast<uint32_t>(needed);
+	bytes += needed;
+	return true;
+}
+
+void CaptureWriter::close()
+{
+	if(fd < 0)
+	{
+		return;
+	}
+
+	uint64_t end = CAPTURE_HEADER_SIZE;
+	std::vector<CaptureChunkHeader> index;
+	if(header != nullptr && header->num_chunks > 0)
+	{
+		// Every chunk before the current one is full size, only its header is needed
+		for(uint64_t i = 0; i < chunk_index; i++)
+		{
+			CaptureChunkHeader chdr;
+			if(pread(fd, &chdr, sizeof(chdr), chunk_offset(i, chunk_size)) != sizeof(chdr))
+			{
+				LogError("Could not read back capture chunk %llu\n", static_cast<unsigned long long>(i));
+				break;
+			}
+			index.push_back(chdr);
+		}
+		if(chunk != nullptr)
+		{
+			CaptureChunkHeader* chdr = reinterpret_cast<CaptureChunkHeader*>(chunk);
+			index.push_back(*chdr);
+			end = chunk_offset(chunk_index, chunk_size) + sizeof(CaptureChunkHeader) + chdr->used;
+		}
+	}
+	unmap_chunk();
+
+	if(header != nullptr)
+	{
+		// Index right after the last record, so the file is no bigger than its contents
+		size_t index_size = index.size() * sizeof(CaptureChunkHeader);
+		if(ftruncate(fd, end + index_size) == 0 &&
+			pwrite(fd, index.data(), index_size, end) == static_cast<ssize_t>(index_size))
+		{
+			header->num_chunks = index.size();
+			header->index_offset = end;
+		}
+		else
+		{
+			LogError("Could not write the index of capture file %s\n", path.c_str());
+		}
+		munmap(header, CAPTURE_HEADER_SIZE);
+		header = nullptr;
+	}
+
+	::close(fd);
+	fd = -1;
+}
+
+#else
+
+bool CaptureWriter::open(const std::string& fpath, size_t fchunk_size)
+{
+	(void)fchunk_size;
+	LogError("Capture files are not supported on this platform (%s)\n", fpath.c_str());
+	return false;
+}
+
+bool CaptureWriter::map_chunk(uint64_t index)
+{
+	(void)index;
+	return false;
+}
+
+void CaptureWriter::unmap_chunk()
+{
+}
+
+bool CaptureWriter::append(uint8_t type, bool roll, const uint8_t* payload, size_t size, uint64_t time_ns)
+{
+	(void)type; (void)roll; (void)payload; (void)size; (void)time_ns;
+	return false;
+}
+
+void CaptureWriter::close()
+{
+}
+
+#endif
+
+bool CaptureWriter::append_frame(const uint8_t* raw, size_t size, bool roll, uint64_t time_ns)
+{
+	if(!append(CaptureRecordHeader::FRAME, roll, raw, size, time_ns))
+	{
+		return false;
+	}
+
+	CaptureChunkHeader* chdr = reinterpret_cast<CaptureChunkHeader*>(chunk);
+	chdr->num_frames++;
+	frames++;
+
+	// Extremes for the index, so a viewer can find where the signal went without reading it all
+	for(size_t offset = 0; offset + DATA_BLOCK_SIZE <= size; offset += DATA_BLOCK_SIZE)
+	{
+		const uint8_t* block = raw + offset;
+		int ch = block[0] == 0x00 ? 0 : 1;
+		const int8_t* samples = reinterpret_cast<const int8_t*>(block + BLOCK_SAMPLES_OFFSET);
+		auto range = std::minmax_element(samples, samples + BLOCK_SAMPLES);
+		chdr->min[ch] = std::min(chdr->min[ch], *range.first);
+		chdr->max[ch] = std::max(chdr->max[ch], *range.second);
+	}
+	return true;
+}
+
+bool CaptureWriter::append_config(const CaptureConfig& config, uint64_t time_ns)
+{
+	return append(CaptureRecordHeader::CONFIG, config.roll != 0,
+		reinterpret_cast<const uint8_t*>(&config), sizeof(config), time_ns);
+}
+
+CaptureReader::CaptureReader()
+:	data(nullptr)
+,	size(0)
+,	cur_chunk(0)
+,	cur_offset(0)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+	close();
+}
+
+#ifdef CAPTURE_MMAP
+
+bool CaptureReader::open(const std::string& path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		LogError("Could not open capture file %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < CAPTURE_HEADER_SIZE)
+	{
+		LogError("%s is not a capture file\n", path.c_str());
+		::close(fd);
+		return false;
+	}
+
+	size = static_cast<size_t>(st.st_size);
+	void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping stays valid without the descriptor
+	::close(fd);
+	if(map == MAP_FAILED)
+	{
+		LogError("Could not map capture file %s: %s\n", path.c_str(), strerror(errno));
+		size = 0;
+		return false;
+	}
+	data = static_cast<const uint8_t*>(map);
+	// Records are read front to back
+	madvise(const_cast<uint8_t*>(data), size, MADV_SEQUENTIAL);
+
+	const CaptureFileHeader& hdr = get_header();
+	if(memcmp(hdr.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || hdr.version != FILE_VERSION || hdr.chunk_size == 0)
+	{
+		LogError("%s is not a capture file, or from an unsupported version\n", path.c_str());
+		close();
+		return false;
+	}
+
+	uint64_t index_size = hdr.num_chunks * sizeof(CaptureChunkHeader);
+	if(hdr.index_offset != 0 && hdr.index_offset + index_size <= size)
+	{
+		const CaptureChunkHeader* entries = reinterpret_cast<const CaptureChunkHeader*>(data + hdr.index_offset);
+		index.assign(entries, entries + hdr.num_chunks);
+	}
+	else
+	{
+		// Not closed properly, the chunk headers are up to date as of the last record
+		LogWarning("Capture file %s was not closed, rebuilding its index\n", path.c_str());
+		for(uint64_t i = 0; chunk_offset(i, hdr.chunk_size) + sizeof(CaptureChunkHeader) <= size; i++)
+		{
+			const CaptureChunkHeader* chdr = reinterpret_cast<const CaptureChunkHeader*>(data + chunk_offset(i, hdr.chunk_size));
+			if(memcmp(chdr->magic, CHUNK_MAGIC, sizeof(CHUNK_MAGIC)) != 0)
+			{
+				break;
+			}
+			index.push_back(*chdr);
+		}
+	}
+
+	seek(0);
+	return true;
+}
+
+void CaptureReader::close()
+{
+	if(data != nullptr)
+	{
+		munmap(const_cast<uint8_t*>(data), size);
+		data = nullptr;
+		size = 0;
+	}
+	index.clear();
+}
+
+#else
+
+bool CaptureReader::open(const std::string& path)
+{
+	LogError("Capture files are not supported on this platform (%s)\n", path.c_str());
+	return false;
+}
+
+void CaptureReader::close()
+{
+}
+
+#endif
+
+size_t CaptureReader::find_chunk(uint64_t time_ns) const
+{
+	for(size_t i = 0; i < index.size(); i++)
+	{
+		if(index[i].num_records > 0 && index[i].last_ns >= time_ns)
+		{
+			return i;
+		}
+	}
+	return index.size();
+}
+
+void CaptureReader::seek(size_t chunk)
+{
+	cur_chunk = chunk;
+	cur_offset = 0;
+}
+
+bool CaptureReader::next(Record& record)
+{
+	if(data == nullptr)
+	{
+		return false;
+	}
+
+	uint64_t chunk_size = get_header().chunk_size;
+	while(cur_chunk < index.size())
+	{
+		uint64_t base = chunk_offset(cur_chunk, chunk_size) + sizeof(CaptureChunkHeader);
+		if(cur_offset + sizeof(CaptureRecordHeader) <= index[cur_chunk].used)
+		{
+			const CaptureRecordHeader* rhdr = reinterpret_cast<const CaptureRecordHeader*>(data + base + cur_offset);
+			size_t end = cur_offset + sizeof(CaptureRecordHeader) + rhdr->size;
+			if(end <= index[cur_chunk].used && base + end <= size)
+			{
+				record.header = rhdr;
+				record.payload = data + base + cur_offset + sizeof(CaptureRecordHeader);
+				cur_offset = end;
+				return true;
+			}
+		}
+
+		cur_chunk++;
+		cur_offset = 0;
+	}
+	return false;
+}
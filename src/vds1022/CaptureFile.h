@@ -0,0 +1,153 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Driver.h"
+
+// Recordings of raw CMD_GET_DATA replies, to be analyzed or replayed later.
+//
+// Layout, everything little endian:
+// - CaptureFileHeader, padded to CAPTURE_HEADER_SIZE
+// - chunks of chunk_size bytes, each starting with a CaptureChunkHeader
+//   followed by records (CaptureRecordHeader + payload) until "used"
+// - once closed, a copy of every chunk header, at index_offset
+//
+// Chunk headers are kept up to date while recording, so a file that was not
+// closed properly can still be read by scanning them. The last chunk is cut
+// to its used size on close.
+#pragma pack(push, 1)
+
+struct CaptureFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t chunk_size;
+	// Wall clock time of the start of the recording, ns since the epoch
+	uint64_t start_time_ns;
+	uint64_t num_chunks;
+	// 0 until the recording is closed
+	uint64_t index_offset;
+};
+
+// Also the entry of the chunk in the index
+struct CaptureChunkHeader
+{
+	char magic[4];
+	// Bytes of records after this header
+	uint32_t used;
+	// Host time of the first and last frame, ns since the start of the recording
+	uint64_t first_ns;
+	uint64_t last_ns;
+	// Frames in the chunk, each being a trigger (or a roll mode read)
+	uint32_t num_frames;
+	uint32_t num_records;
+	// Extremes of the samples of each channel, min > max if there were none
+	int8_t min[2];
+	int8_t max[2];
+};
+
+struct CaptureRecordHeader
+{
+	enum Type
+	{
+		// Reply to CMD_GET_DATA
+		FRAME,
+		// CaptureConfig active from now on
+		CONFIG
+	};
+
+	uint8_t type;
+	uint8_t roll;
+	uint16_t reserved;
+	uint32_t size;
+	// Host time, ns since the start of the recording
+	uint64_t time_ns;
+};
+
+struct CaptureConfig
+{
+	uint64_t sample_rate;
+	uint8_t peak_detect;
+	uint8_t roll;
+	TriggerConfig trigger;
+	// Calibrated range of each channel, see Driver::RANGE_VOLTS_DIV
+	uint8_t ranges[2];
+};
+
+#pragma pack(pop)
+
+static const size_t CAPTURE_HEADER_SIZE = 4096;
+
+// Appends to a recording through a memory mapping of the chunk being filled,
+// so recording a frame is a copy and nothing else. Not thread safe.
+class CaptureWriter
+{
+public:
+	CaptureWriter();
+	~CaptureWriter();
+
+	// chunk_size is rounded up to a multiple of 64 kB
+	bool open(const std::string& path, size_t chunk_size = 8 << 20);
+	void close();
+	bool is_open() const { return fd >= 0; }
+
+	bool append_frame(const uint8_t* raw, size_t size, bool roll, uint64_t time_ns);
+	bool append_config(const CaptureConfig& config, uint64_t time_ns);
+
+	uint64_t get_frames() const { return frames; }
+	uint64_t get_bytes() const { return bytes; }
+	const std::string& get_path() const { return path; }
+
+protected:
+
+	bool append(uint8_t type, bool roll, const uint8_t* payload, size_t size, uint64_t time_ns);
+	bool map_chunk(uint64_t index);
+	void unmap_chunk();
+
+	std::string path;
+	int fd;
+	size_t chunk_size;
+	CaptureFileHeader* header;
+	uint8_t* chunk;
+	uint64_t chunk_index;
+
+	uint64_t frames;
+	uint64_t bytes;
+};
+
+// Reads a recording through a memory mapping of the whole file
+class CaptureReader
+{
+public:
+	CaptureReader();
+	~CaptureReader();
+
+	bool open(const std::string& path);
+	void close();
+
+	const CaptureFileHeader& get_header() const { return *reinterpret_cast<const CaptureFileHeader*>(data); }
+	const std::vector<CaptureChunkHeader>& get_index() const { return index; }
+	// Index of the chunk holding time_ns, for seeking
+	size_t find_chunk(uint64_t time_ns) const;
+
+	struct Record
+	{
+		const CaptureRecordHeader* header;
+		const uint8_t* payload;
+	};
+
+	// Goes through the records from the start of a chunk
+	void seek(size_t chunk);
+	bool next(Record& record);
+
+protected:
+
+	std::vector<CaptureChunkHeader> index;
+	const uint8_t* data;
+	size_t size;
+
+	size_t cur_chunk;
+	size_t cur_offset;
+};
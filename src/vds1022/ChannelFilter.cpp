@@ -0,0 +1,234 @@
+#include "ChannelFilter.h"
+
+#include <algorithm>
+#include <cmath>
+
+ChannelFilter::ChannelFilter()
+:	type(NONE)
+,	freq_hz(0.0)
+,	param(0.0)
+,	primed(false)
+{
+}
+
+void ChannelFilter::configure(Type _type, double _freq_hz, double _param, double sample_rate)
+{
+	type = _type;
+	freq_hz = _freq_hz;
+	param = _param;
+
+	biquads.clear();
+	fir.clear();
+
+	// Nothing to filter at or over Nyquist
+	if(sample_rate <= 0 || freq_hz <= 0 || freq_hz >= sample_rate / 2)
+	{
+		type = NONE;
+	}
+
+	if(type == FIR_LOWPASS)
+	{
+		design_fir(sample_rate);
+	}
+	else if(type != NONE)
+	{
+		design_biquads(sample_rate);
+	}
+
+	reset();
+}
+
+void ChannelFilter::design_biquads(double sample_rate)
+{
+	// Biquads from the RBJ audio EQ cookbook
+	const double w0 = 2.0 * M_PI * freq_hz / sample_rate;
+	const double cosw = std::cos(w0);
+	const double sinw = std::sin(w0);
+
+	std::vector<double> qs;
+	if(type == NOTCH)
+	{
+		qs.push_back(param > 0 ? param : 10.0);
+	}
+	else
+	{
+		// Q of each section of a 4th order Butterworth
+		qs.push_back(0.54119610);
+		qs.push_back(1.30656296);
+	}
+
+	for(double q : qs)
+	{
+		double alpha = sinw / (2.0 * q);
+		double b0, b1, b2;
+		if(type == LOWPASS)
+		{
+			b0 = (1.0 - cosw) / 2.0;
+			b1 = 1.0 - cosw;
+			b2 = b0;
+		}
+		else if(type == HIGHPASS)
+		{
+			b0 = (1.0 + cosw) / 2.0;
+			b1 = -(1.0 + cosw);
+			b2 = b0;
+		}
+		else
+		{
+			b0 = 1.0;
+			b1 = -2.0 * cosw;
+			b2 = 1.0;
+		}
+		double a0 = 1.0 + alpha;
+
+		Biquad bq{};
+		bq.b0 = static_cast<float>(b0 / a0);
+		bq.b1 = static_cast<float>(b1 / a0);
+		bq.b2 = static_cast<float>(b2 / a0);
+		bq.a1 = static_cast<float>(-2.0 * cosw / a0);
+		bq.a2 = static_cast<float>((1.0 - alpha) / a0);
+		biquads.push_back(bq);
+	}
+}
+
+void ChannelFilter::design_fir(double sample_rate)
+{
+	uint32_t taps = static_cast<uint32_t>(param);
+	taps = taps < 3 ? 3 : (taps > MAX_FIR_TAPS ? MAX_FIR_TAPS : taps);
+	// Odd length so the delay is a whole number of samples
+	taps |= 1;
+	param = taps;
+
+	// Blackman windowed sinc, unity gain at DC
+	const double fc = freq_hz / sample_rate;
+	const double center = (taps - 1) / 2.0;
+	fir.resize(taps);
+	double sum = 0.0;
+	for(uint32_t k = 0; k < taps; k++)
+	{
+		double x = k - center;
+		double sinc = x == 0.0 ? 2.0 * fc : std::sin(2.0 * M_PI * fc * x) / (M_PI * x);
+		double w = 0.42 - 0.5 * std::cos(2.0 * M_PI * k / (taps - 1)) + 0.08 * std::cos(4.0 * M_PI * k / (taps - 1));
+		fir[k] = static_cast<float>(sinc * w);
+		sum += fir[k];
+	}
+	for(auto& c : fir)
+	{
+		c = static_cast<float>(c / sum);
+	}
+
+	// Sized for a whole frame, so processing never allocates
+	fir_buf.assign(taps - 1 + 5100, 0.0f);
+	fir_out.assign(5100, 0.0f);
+}
+
+void ChannelFilter::reset()
+{
+	primed = false;
+}
+
+void ChannelFilter::process(uint8_t* codes, size_t count)
+{
+	if(type == NONE || count == 0)
+	{
+		return;
+	}
+
+	const float first = static_cast<int8_t>(codes[0]);
+
+	if(type == FIR_LOWPASS)
+	{
+		run_fir(codes, count, 0);
+	}
+	else
+	{
+		if(!primed)
+		{
+			// Steady state of each section for a constant input
+			float x = first;
+			for(auto& bq : biquads)
+			{
+				float gain = (bq.b0 + bq.b1 + bq.b2) / (1.0f + bq.a1 + bq.a2);
+				float y = x * gain;
+				bq.z1 = y - bq.b0 * x;
+				bq.z2 = bq.b2 * x - bq.a2 * y;
+				x = y;
+			}
+		}
+
+		// Every sample depends on the previous one, so this one stays scalar
+		for(size_t i = 0; i < count; i++)
+		{
+			float x = static_cast<int8_t>(codes[i]);
+			for(auto& bq : biquads)
+			{
+				float y = bq.b0 * x + bq.z1;
+				bq.z1 = bq.b1 * x - bq.a1 * y + bq.z2;
+				bq.z2 = bq.b2 * x - bq.a2 * y;
+				x = y;
+			}
+			float v = std::round(x);
+			codes[i] = static_cast<uint8_t>(static_cast<int8_t>(std::max(-128.0f, std::min(v, 127.0f))));
+		}
+	}
+
+	primed = true;
+}
+
+void ChannelFilter::process_block(uint8_t* codes, size_t count)
+{
+	reset();
+	if(type == FIR_LOWPASS && count > 0)
+	{
+		run_fir(codes, count, (fir.size() - 1) / 2);
+		primed = true;
+		return;
+	}
+	process(codes, count);
+}
+
+void ChannelFilter::run_fir(uint8_t* codes, size_t count, size_t delay)
+{
+	const size_t taps = fir.size();
+	const size_t history = taps - 1;
+	if(!primed)
+	{
+		std::fill(fir_buf.begin(), fir_buf.begin() + history, static_cast<float>(static_cast<int8_t>(codes[0])));
+	}
+
+	// Outputs are written behind the inputs already read, so in place is fine
+	const float last = static_cast<int8_t>(codes[count - 1]);
+	const size_t total = count + delay;
+	size_t done = 0;
+	while(done < total)
+	{
+		size_t n = std::min(total - done, fir_out.size());
+		for(size_t i = 0; i < n; i++)
+		{
+			fir_buf[history + i] = done + i < count ? static_cast<int8_t>(codes[done + i]) : last;
+		}
+
+		// Loop over outputs innermost so it vectorizes
+		std::fill(fir_out.begin(), fir_out.begin() + n, 0.0f);
+		for(size_t k = 0; k < taps; k++)
+		{
+			const float c = fir[k];
+			const float* in = fir_buf.data() + k;
+			float* out = fir_out.data();
+			for(size_t i = 0; i < n; i++)
+			{
+				out[i] += c * in[i];
+			}
+		}
+
+		for(size_t i = done < delay ? delay - done : 0; i < n; i++)
+		{
+			float v = std::round(fir_out[i]);
+			codes[done + i - delay] = static_cast<uint8_t>(static_cast<int8_t>(std::max(-128.0f, std::min(v, 127.0f))));
+		}
+
+		// Keep the last inputs as history for the next call
+		std::copy(fir_buf.begin() + n, fir_buf.begin() + n + history, fir_buf.begin());
+		done += n;
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Software filter applied to the ADC codes of a channel before any other
+// processing. Low / high pass are 4th order Butterworth (two biquads), the
+// notch is a single biquad, and the FIR low pass is a windowed sinc.
+// Coefficients are only computed when the settings change. Filter state
+// carries over between calls, so roll mode chunks are filtered as one
+// continuous signal; block mode frames go through process_block().
+class ChannelFilter
+{
+public:
+	enum Type
+	{
+		NONE,
+		LOWPASS,
+		HIGHPASS,
+		NOTCH,
+		FIR_LOWPASS,
+	};
+
+	static const uint32_t MAX_FIR_TAPS = 255;
+
+	ChannelFilter();
+
+	// param is the Q of the notch, or the number of taps of the FIR
+	void configure(Type type, double freq_hz, double param, double sample_rate);
+	Type get_type() const { return type; }
+	double get_freq() const { return freq_hz; }
+	double get_param() const { return param; }
+
+	// Clears the filter state, the next sample is taken as having been
+	// there forever so there's no startup transient
+	void reset();
+
+	// Filters ADC codes in place
+	void process(uint8_t* codes, size_t count);
+	// Filters a whole frame on its own. The FIR delay of (taps - 1) / 2 samples
+	// is taken out, so edges stay where they were relative to the trigger,
+	// with the samples past the end taken as the last one.
+	void process_block(uint8_t* codes, size_t count);
+
+protected:
+
+	struct Biquad
+	{
+		float b0, b1, b2, a1, a2;
+		// Transposed direct form II state
+		float z1, z2;
+	};
+
+	void design_biquads(double sample_rate);
+	void design_fir(double sample_rate);
+	// Output is delay samples behind the input, which is padded to match
+	void run_fir(uint8_t* codes, size_t count, size_t delay);
+
+	Type type;
+	double freq_hz;
+	double param;
+	bool primed;
+
+	std::vector<Biquad> biquads;
+
+	std::vector<float> fir;
+	// taps - 1 previous inputs, followed by the samples being filtered
+	std::vector<float> fir_buf;
+	std::vector<float> fir_out;
+};
@@ -0,0 +1,134 @@
+#include "DeadTimeAnalyzer.h"
+
+#include <cstdio>
+
+static uint64_t span_ns(AcquisitionTimes::Clock::time_point from, AcquisitionTimes::Clock::time_point to)
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+}
+
+DeadTimeAnalyzer::DeadTimeAnalyzer()
+:	entries{}
+,	num_entries(0)
+,	next_replaced(0)
+,	has_last(false)
+,	last_generation(0)
+{
+}
+
+void DeadTimeAnalyzer::reset()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	num_entries = 0;
+	next_replaced = 0;
+	has_last = false;
+}
+
+DeadTimeAnalyzer::Entry* DeadTimeAnalyzer::find(const Config& config)
+{
+	for(size_t i = 0; i < num_entries; i++)
+	{
+		if(entries[i].config == config)
+		{
+			return &entries[i];
+		}
+	}
+
+	Entry* entry;
+	if(num_entries < MAX_CONFIGS)
+	{
+		entry = &entries[num_entries++];
+	}
+	else
+	{
+		entry = &entries[next_replaced];
+		next_replaced = (next_replaced + 1) % MAX_CONFIGS;
+	}
+	*entry = Entry{};
+	entry->config = config;
+	return entry;
+}
+
+void DeadTimeAnalyzer::add_frame(const Config& config, uint32_t generation, const AcquisitionTimes& times, Clock::time_point sent)
+{
+	const Clock::time_point none{};
+	std::lock_guard<std::mutex> lock(mtx);
+	Entry& entry = *find(config);
+	entry.frames++;
+
+	if(has_last && generation == last_generation && times.transferred > last_transferred)
+	{
+		entry.cycles++;
+		entry.cycle_ns += span_ns(last_transferred, times.transferred);
+	}
+	has_last = true;
+	last_generation = generation;
+	last_transferred = times.transferred;
+
+	// Only phases with both ends seen
+	Clock::time_point points[5] = {times.armed, times.triggered, times.finished, times.transferred, sent};
+	for(size_t p = 0; p < 4; p++)
+	{
+		if(points[p] == none || points[p + 1] == none || points[p + 1] < points[p])
+		{
+			continue;
+		}
+		entry.phase_count[p]++;
+		entry.phase_ns[p] += span_ns(points[p], points[p + 1]);
+	}
+}
+
+size_t DeadTimeAnalyzer::get_stats(Stats* out, size_t max) const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	size_t count = 0;
+	for(size_t i = 0; i < num_entries && count < max; i++)
+	{
+		const Entry& entry = entries[i];
+		Stats& stats = out[count++];
+		stats = Stats{};
+		stats.config = entry.config;
+		stats.frames = entry.frames;
+		if(entry.config.sample_rate > 0)
+		{
+			stats.window_us = RECORD_SAMPLES * 1e6 / entry.config.sample_rate;
+		}
+		if(entry.cycles > 0)
+		{
+			stats.cycle_us = entry.cycle_ns * 1e-3 / entry.cycles;
+			stats.waveforms_per_s = 1e6 / stats.cycle_us;
+			// A cycle shorter than the window would mean records overlap, which the device doesn't do
+			stats.dead_fraction = stats.cycle_us > stats.window_us ? 1.0 - stats.window_us / stats.cycle_us : 0.0;
+		}
+
+		double* phases[4] = {&stats.armed_to_triggered_us, &stats.triggered_to_finished_us,
+			&stats.finished_to_transferred_us, &stats.transferred_to_sent_us};
+		for(size_t p = 0; p < 4; p++)
+		{
+			*phases[p] = entry.phase_count[p] > 0 ? entry.phase_ns[p] * 1e-3 / entry.phase_count[p] : 0.0;
+		}
+	}
+	return count;
+}
+
+std::string DeadTimeAnalyzer::format_table() const
+{
+	Stats stats[MAX_CONFIGS];
+	size_t count = get_stats(stats, MAX_CONFIGS);
+
+	std::string out = "     rate  ch peak   frames   window us    cycle us   wfm/s  dead %"
+		"  arm>trig us  trig>fin us  fin>xfer us  xfer>sent us\n";
+	for(size_t i = 0; i < count; i++)
+	{
+		const Stats& s = stats[i];
+		char line[256];
+		snprintf(line, sizeof(line), "%9llu  %c%c  %3s %8llu %11.1f %11.1f %7.1f %7.2f %12.1f %12.1f %12.1f %13.1f\n",
+			static_cast<unsigned long long>(s.config.sample_rate),
+			(s.config.channels & 1) ? '1' : '-', (s.config.channels & 2) ? '2' : '-',
+			s.config.peak_detect ? "on" : "off", static_cast<unsigned long long>(s.frames),
+			s.window_us, s.cycle_us, s.waveforms_per_s, s.dead_fraction * 100.0,
+			s.armed_to_triggered_us, s.triggered_to_finished_us, s.finished_to_transferred_us, s.transferred_to_sent_us);
+		out += line;
+	}
+	return out;
+}
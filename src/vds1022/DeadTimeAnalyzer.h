@@ -0,0 +1,106 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// When each phase of the acquisition of a frame happened. Phases the device
+// wasn't polled for are left at the epoch.
+struct AcquisitionTimes
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// The device rearms once its record was read out, or when settings change
+	Clock::time_point armed;
+	// First poll of CMD_GET_TRIGGERED seeing the trigger
+	Clock::time_point triggered;
+	// First poll seeing the record complete: CMD_GET_DATAFINISHED if polled,
+	// else the CMD_GET_DATA that got the data
+	Clock::time_point finished;
+	// Record read out over USB
+	Clock::time_point transferred;
+};
+
+// How much of the time the scope is blind, for each configuration it was used
+// with. A record covers RECORD_SAMPLES / sample rate; whatever else a cycle
+// from one readout to the next takes (waiting for the data to be read, the
+// transfer, the host not asking for more) is dead time. The waveform update
+// rate is what the host actually got.
+//
+// Frames must be added in acquisition order. Roll mode has no records and
+// is left out.
+class DeadTimeAnalyzer
+{
+public:
+	typedef AcquisitionTimes::Clock Clock;
+
+	// Samples in the device memory per record, margins included
+	static const size_t RECORD_SAMPLES = 5100;
+	static const size_t MAX_CONFIGS = 32;
+
+	struct Config
+	{
+		uint64_t sample_rate;
+		// Bit 0 for CH1, bit 1 for CH2
+		uint8_t channels;
+		bool peak_detect;
+
+		bool operator==(const Config& other) const
+		{
+			return sample_rate == other.sample_rate && channels == other.channels && peak_detect == other.peak_detect;
+		}
+	};
+
+	struct Stats
+	{
+		Config config;
+		uint64_t frames;
+		// Capture window of a record, and mean time from a readout to the next
+		double window_us;
+		double cycle_us;
+		double waveforms_per_s;
+		double dead_fraction;
+		// Mean time of each phase, 0 if never seen
+		double armed_to_triggered_us;
+		double triggered_to_finished_us;
+		double finished_to_transferred_us;
+		double transferred_to_sent_us;
+	};
+
+	DeadTimeAnalyzer();
+
+	// sent is the epoch for frames which were never sent
+	void add_frame(const Config& config, uint32_t generation, const AcquisitionTimes& times, Clock::time_point sent);
+	void reset();
+
+	// Configurations seen so far, in the order they were first used
+	size_t get_stats(Stats* out, size_t max) const;
+	// One line per configuration, with a header
+	std::string format_table() const;
+
+protected:
+
+	struct Entry
+	{
+		Config config;
+		uint64_t frames;
+		// Cycles only count between frames of the same settings
+		uint64_t cycles;
+		uint64_t cycle_ns;
+		uint64_t phase_count[4];
+		uint64_t phase_ns[4];
+	};
+
+	Entry* find(const Config& config);
+
+	mutable std::mutex mtx;
+	Entry entries[MAX_CONFIGS];
+	size_t num_entries;
+	// Oldest entry, replaced once all are used
+	size_t next_replaced;
+
+	bool has_last;
+	uint32_t last_generation;
+	Clock::time_point last_transferred;
+};
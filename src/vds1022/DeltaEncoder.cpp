@@ -0,0 +1,107 @@
+#include "DeltaEncoder.h"
+
+#include <cstdlib>
+#include <cstring>
+
+DeltaEncoder::DeltaEncoder()
+:	threshold(0)
+,	keyframe_interval(100)
+,	has_reference(false)
+,	since_keyframe(0)
+,	reference{}
+,	keyframes(0)
+,	deltas(0)
+,	encoded_bytes(0)
+{
+	// Worst case before falling back to a keyframe, so encoding never allocates
+	runs.reserve(NUM_SAMPLES / (MERGE_GAP + 1) + 1);
+}
+
+void DeltaEncoder::configure(uint8_t thres, uint32_t interval)
+{
+	threshold = thres;
+	keyframe_interval = interval > 0 ? interval : 1;
+	reset();
+}
+
+void DeltaEncoder::reset()
+{
+	has_reference = false;
+	since_keyframe = 0;
+	runs.clear();
+}
+
+void DeltaEncoder::reset_stats()
+{
+	keyframes = 0;
+	deltas = 0;
+	encoded_bytes = 0;
+}
+
+bool DeltaEncoder::encode(const uint8_t* samples)
+{
+	runs.clear();
+
+	if(!has_reference || since_keyframe + 1 >= keyframe_interval)
+	{
+		std::memcpy(reference, samples, NUM_SAMPLES);
+		has_reference = true;
+		since_keyframe = 0;
+		keyframes++;
+		encoded_bytes += NUM_SAMPLES;
+		return true;
+	}
+
+	size_t size = 0;
+	size_t i = 0;
+	while(i < NUM_SAMPLES)
+	{
+		// Codes are signed
+		int diff = std::abs(static_cast<int8_t>(samples[i]) - static_cast<int8_t>(reference[i]));
+		if(diff <= threshold)
+		{
+			i++;
+			continue;
+		}
+
+		// Extend the last run over a short gap rather than starting a new one
+		if(!runs.empty() && i - (runs.back().start + runs.back().length) <= MERGE_GAP)
+		{
+			Run& run = runs.back();
+			size += i + 1 - (run.start + run.length);
+			run.length = static_cast<uint16_t>(i + 1 - run.start);
+		}
+		else
+		{
+			runs.push_back(Run{static_cast<uint16_t>(i), 1});
+			size += RUN_HEADER_SIZE + 1;
+		}
+
+		if(size >= NUM_SAMPLES)
+		{
+			break;
+		}
+		i++;
+	}
+
+	// Not worth it, a keyframe is as small and resyncs the client
+	if(size >= NUM_SAMPLES)
+	{
+		runs.clear();
+		std::memcpy(reference, samples, NUM_SAMPLES);
+		since_keyframe = 0;
+		keyframes++;
+		encoded_bytes += NUM_SAMPLES;
+		return true;
+	}
+
+	// The client now has exactly the samples of the runs
+	for(const Run& run : runs)
+	{
+		std::memcpy(reference + run.start, samples + run.start, run.length);
+	}
+	since_keyframe++;
+	deltas++;
+	encoded_bytes += size;
+	return false;
+}
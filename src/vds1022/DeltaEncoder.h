@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Encodes the frames of a channel as changes against the previous one sent,
+// for steady signals where most of a frame repeats. Keeps a copy of the
+// frame as the client has it, so small changes left out (up to the threshold)
+// never add up to a drift. A full frame (keyframe) goes out every so often so
+// a client can resync, and whenever the changes would be as big anyway.
+class DeltaEncoder
+{
+public:
+	static const size_t NUM_SAMPLES = 5000;
+
+	// Changed samples closer than this are sent as one run, as the header of
+	// a new run would cost as much as the samples in between
+	static const size_t MERGE_GAP = 4;
+	static const size_t RUN_HEADER_SIZE = 4;
+
+	struct Run
+	{
+		uint16_t start;
+		uint16_t length;
+	};
+
+	DeltaEncoder();
+
+	// threshold in ADC codes, a sample only counts as changed if it moved by more
+	void configure(uint8_t threshold, uint32_t keyframe_interval);
+	uint8_t get_threshold() const { return threshold; }
+	uint32_t get_keyframe_interval() const { return keyframe_interval; }
+	// Next frame is a keyframe
+	void reset();
+
+	// Returns true if samples must be sent in full, else the runs of samples to
+	// send are in get_runs() (none if nothing changed)
+	bool encode(const uint8_t* samples);
+	const std::vector<Run>& get_runs() const { return runs; }
+
+	uint64_t get_keyframes() const { return keyframes; }
+	uint64_t get_deltas() const { return deltas; }
+	// Bytes of samples and run headers sent, against what full frames would have taken
+	uint64_t get_encoded_bytes() const { return encoded_bytes; }
+	uint64_t get_full_bytes() const { return (keyframes + deltas) * NUM_SAMPLES; }
+	void reset_stats();
+
+protected:
+
+	uint8_t threshold;
+	uint32_t keyframe_interval;
+
+	bool has_reference;
+	uint32_t since_keyframe;
+	uint8_t reference[NUM_SAMPLES];
+	std::vector<Run> runs;
+
+	uint64_t keyframes;
+	uint64_t deltas;
+	uint64_t encoded_bytes;
+};
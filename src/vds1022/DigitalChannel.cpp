@@ -0,0 +1,124 @@
+#include "DigitalChannel.h"
+
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static int8_t clamp_code(float code)
+{
+	float r = std::round(code);
+	return static_cast<int8_t>(r < -128.0f ? -128.0f : (r > 127.0f ? 127.0f : r));
+}
+
+// Resolves a group of up to 16 samples, given which ones are over the high
+// level and under the low level. Samples that are neither keep the level
+// before them.
+static uint16_t resolve_hysteresis(uint16_t above, uint16_t below, size_t count, bool& state)
+{
+	uint16_t determined = above | below;
+	uint16_t full = count == 16 ? 0xFFFF : static_cast<uint16_t>((1u << count) - 1);
+
+	uint16_t out;
+	if((determined & full) == full)
+	{
+		out = above;
+	}
+	else
+	{
+		out = 0;
+		bool s = state;
+		for(size_t i = 0; i < count; i++)
+		{
+			uint16_t bit = static_cast<uint16_t>(1u << i);
+			if(above & bit)
+			{
+				s = true;
+			}
+			else if(below & bit)
+			{
+				s = false;
+			}
+			out |= s ? bit : 0;
+		}
+	}
+
+	state = (out >> (count - 1)) & 1;
+	return out & full;
+}
+
+DigitalChannel::DigitalChannel()
+:	hi(0)
+,	lo(0)
+,	bits{}
+,	edges{}
+,	num_edges(0)
+{
+}
+
+void DigitalChannel::configure(float threshold, float hysteresis)
+{
+	float half = std::fabs(hysteresis) / 2.0f;
+	hi = clamp_code(threshold + half);
+	lo = clamp_code(threshold - half);
+}
+
+void DigitalChannel::push_frame(const AcquiredData& data)
+{
+	// Skip the 50 pre samples
+	const int8_t* samples = reinterpret_cast<const int8_t*>(data.samples.data() + 50);
+
+	// Starting level is taken from the first sample against the threshold center
+	bool state = samples[0] > (hi + lo) / 2;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	// Compare 16 samples at once, movemask packs the results as bits directly
+	const __m128i vhi = _mm_set1_epi8(hi);
+	const __m128i vlo = _mm_set1_epi8(lo);
+	for(; i + 16 <= NUM_SAMPLES; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+		uint16_t above = static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(v, vhi)));
+		uint16_t below = static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmplt_epi8(v, vlo)));
+
+		uint16_t out = resolve_hysteresis(above, below, 16, state);
+		bits[i / 8] = static_cast<uint8_t>(out);
+		bits[i / 8 + 1] = static_cast<uint8_t>(out >> 8);
+	}
+#endif
+
+	for(; i < NUM_SAMPLES; i += 8)
+	{
+		size_t count = NUM_SAMPLES - i < 8 ? NUM_SAMPLES - i : 8;
+		uint16_t above = 0;
+		uint16_t below = 0;
+		for(size_t j = 0; j < count; j++)
+		{
+			above |= samples[i + j] > hi ? (1u << j) : 0;
+			below |= samples[i + j] < lo ? (1u << j) : 0;
+		}
+		bits[i / 8] = static_cast<uint8_t>(resolve_hysteresis(above, below, count, state));
+	}
+
+	// Edges are wherever a bit differs from the one before it
+	num_edges = 0;
+	uint8_t prev = bits[0] & 1;
+	for(size_t b = 0; b < NUM_BYTES; b++)
+	{
+		uint8_t cur = bits[b];
+		uint8_t diff = cur ^ static_cast<uint8_t>((cur << 1) | prev);
+		if(b == NUM_BYTES - 1 && NUM_SAMPLES % 8)
+		{
+			diff &= static_cast<uint8_t>((1u << (NUM_SAMPLES % 8)) - 1);
+		}
+		while(diff)
+		{
+			int bit = __builtin_ctz(diff);
+			edges[num_edges++] = static_cast<uint16_t>(b * 8 + bit);
+			diff &= static_cast<uint8_t>(diff - 1);
+		}
+		prev = cur >> 7;
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+#include "Driver.h"
+
+// Virtual digital channel derived from an analog one through a comparator
+// with hysteresis. Output is packed 1 bit per sample (LSB first) along
+// with the index of every sample where the level changes.
+class DigitalChannel
+{
+public:
+	static const size_t NUM_SAMPLES = 5000;
+	static const size_t NUM_BYTES = (NUM_SAMPLES + 7) / 8;
+
+	DigitalChannel();
+
+	// In ADC codes. Samples over threshold + hysteresis / 2 read high, under
+	// threshold - hysteresis / 2 read low, and anything in between keeps the
+	// previous level.
+	void configure(float threshold, float hysteresis);
+
+	void push_frame(const AcquiredData& data);
+
+	const uint8_t* get_bits() const { return bits.data(); }
+	const uint16_t* get_edges() const { return edges.data(); }
+	size_t get_num_edges() const { return num_edges; }
+
+protected:
+
+	int8_t hi;
+	int8_t lo;
+
+	std::array<uint8_t, NUM_BYTES + 1> bits;
+	std::array<uint16_t, NUM_SAMPLES> edges;
+	size_t num_edges;
+};
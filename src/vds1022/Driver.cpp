@@ -13,20 +13,50 @@
 
 // Little-endian! LSB at littlest address
 
-template<typename T>
-void Driver::send_command_raw(uint32_t addr, T data)
+static uint32_t read_le(const uint8_t* ptr, size_t num_bytes)
 {
-	std::array<uint8_t, sizeof(T) + 4 + 1> bytes{};
-	bytes[0] = addr & 0xFF;
-	bytes[1] = (addr & 0xFF00) >> (8 * 1);
-	bytes[2] = (addr & 0xFF0000) >> (8 * 2);
-	bytes[3] = (addr & 0xFF000000) >> (8 * 3);
-	bytes[4] = sizeof(T);
+	uint32_t out = 0;
+	for(size_t i = 0; i < num_bytes; i++)
+	{
+		out |= static_cast<uint32_t>(ptr[i]) << (8 * i);
+	}
+	return out;
+}
+
+const double Driver::RANGE_VOLTS_DIV[Driver::NUM_RANGES] =
+{
+	5e-3, 10e-3, 20e-3, 50e-3, 100e-3, 200e-3, 500e-3, 1.0, 2.0, 5.0
+};
+
+const int32_t Driver::SAMPLE_RATES[Driver::NUM_SAMPLE_RATES] =
+{
+	25, 50, 125, 250, 500, 1250, 2500, 5000, 12500, 25000, 50000, 125000, 250000,
+	1250000, 2500000, 5000000, 12500000, 25000000, 50000000, 100000000
+};
+
+// Ranges from this one up go through the input attenuator
+static const size_t ATTENUATED_RANGE = 6;
+
+size_t Driver::encode_command(uint8_t* out, uint32_t addr, uint8_t size, uint32_t data)
+{
+	out[0] = addr & 0xFF;
+	out[1] = (addr & 0xFF00) >> (8 * 1);
+	out[2] = (addr & 0xFF0000) >> (8 * 2);
+	out[3] = (addr & 0xFF000000) >> (8 * 3);
+	out[4] = size;
 	// write data
-	for(size_t i = 0; i < sizeof(T); i++)
+	for(size_t i = 0; i < size; i++)
 	{
-		bytes[5 + i] = (data >> (8 * i)) & 0xFF;
+		out[5 + i] = (data >> (8 * i)) & 0xFF;
 	}
+	return 5 + size;
+}
+
+template<typename T>
+void Driver::send_command_raw(uint32_t addr, T data)
+{
+	std::array<uint8_t, sizeof(T) + 4 + 1> bytes{};
+	encode_command(bytes.data(), addr, sizeof(T), static_cast<uint32_t>(data));
 	// Because this transfer is very small, we can just ignore
 	// the timeouts and message division that libusb may do
 	libusb_bulk_transfer(hnd, write_ep, bytes.data(), bytes.size(), nullptr, 0);
@@ -57,6 +87,22 @@ CommandResponse Driver::receive_response() const
 
 }
 
+Driver::Driver()
+:	old_board(false)
+,	hnd(nullptr)
+,	write_ep(0)
+,	read_ep(0)
+,	roll_mode(false)
+	// As set by load_default_settings()
+,	channel_reg{0xa0, 0xa0}
+,	channel_range{0, 0}
+,	transfer_pool(READ_BUFFER_SIZE, 1)
+,	read_buffer(static_cast<uint8_t*>(transfer_pool.get(0)))
+,	read_size(0)
+,	shadow{}
+,	num_shadow(0)
+{
+}
 
 bool Driver::init(libusb_device_handle* _hnd, uint8_t _write_ep, uint8_t _read_ep)
 {
@@ -90,6 +136,13 @@ bool Driver::init(libusb_device_handle* _hnd, uint8_t _write_ep, uint8_t _read_e
 
 	load_default_settings();
 
+	// Calibrated 1V/div on both channels, the full scale the bridge starts with
+	if(!push_channel_range(0, find_range(1.0)) || !push_channel_range(1, find_range(1.0)))
+	{
+		LogError("Unable to set the channel ranges\n");
+		return false;
+	}
+
 	return true;
 }
 
@@ -235,34 +288,236 @@ bool Driver::write_firmware_to_fpga()
 	return true;
 }
 
-void Driver::push_sampling_config(int32_t rate, bool peak_detect)
+bool Driver::send_batch(const RegisterWrite* writes, size_t count)
+{
+	bool ok = true;
+	size_t sent = 0;
+	for(; sent < count && ok; sent++)
+	{
+		std::array<uint8_t, 4 + 1 + 4> bytes{};
+		size_t len = encode_command(bytes.data(), writes[sent].addr, writes[sent].size, writes[sent].data);
+		ok = libusb_bulk_transfer(hnd, write_ep, bytes.data(), static_cast<int>(len), nullptr, 0) == 0;
+	}
+
+	// Replies come back in order, one per write that went out. Once one is
+	// missing the rest won't come either.
+	bool replied = true;
+	for(size_t i = 0; i < sent && replied; i++)
+	{
+		std::array<uint8_t, 5> reply{};
+		replied = libusb_bulk_transfer(hnd, read_ep, reply.data(), reply.size(), nullptr,
+			BATCH_REPLY_TIMEOUT_MS) == 0;
+	}
+	ok &= replied;
+
+	if(!ok)
+	{
+		// No telling which of them made it
+		num_shadow = 0;
+		return false;
+	}
+	for(size_t i = 0; i < count; i++)
+	{
+		RegisterWrite* last = find_shadow(writes[i].addr);
+		if(last == nullptr && num_shadow < MAX_SHADOW)
+		{
+			last = &shadow[num_shadow++];
+		}
+		if(last != nullptr)
+		{
+			*last = writes[i];
+		}
+	}
+	return true;
+}
+
+size_t Driver::find_range(double volts_div)
+{
+	for(size_t i = 0; i < NUM_RANGES; i++)
+	{
+		// Some slack so that a range asked for exactly isn't rounded up
+		if(RANGE_VOLTS_DIV[i] >= volts_div * 0.999)
+		{
+			return i;
+		}
+	}
+	return NUM_RANGES - 1;
+}
+
+int32_t Driver::find_sample_rate(uint64_t rate_hz)
+{
+	int32_t rate = 0;
+	for(int32_t r : SAMPLE_RATES)
+	{
+		if(static_cast<uint64_t>(r) <= rate_hz)
+		{
+			rate = r;
+		}
+	}
+	return rate;
+}
+
+static void add_write(Driver::RegisterImage& image, uint32_t addr, uint8_t size, uint32_t data)
+{
+	if(image.count < Driver::RegisterImage::MAX_WRITES)
+	{
+		image.writes[image.count++] = Driver::RegisterWrite{addr, size, data};
+	}
+}
+
+void Driver::compile_channel_range(uint8_t ch, size_t range, RegisterImage& image) const
+{
+	// Keep coupling and channel on/off, only the attenuator follows the range
+	uint8_t reg = channel_reg[ch] & ~0x02;
+	if(range >= ATTENUATED_RANGE)
+	{
+		reg |= 0x02;
+	}
+
+	uint32_t channel_addr = ch == 0 ? CMD_SET_CHANNEL_CH1 : CMD_SET_CHANNEL_CH2;
+	uint32_t gain_addr = ch == 0 ? CMD_SET_VOLT_GAIN_CH1 : CMD_SET_VOLT_GAIN_CH2;
+	uint32_t zero_addr = ch == 0 ? CMD_SET_ZERO_OFF_CH1 : CMD_SET_ZERO_OFF_CH2;
+
+	// Offset stays centered, which is the compensation value of the range
+	add_write(image, channel_addr, 1, reg);
+	add_write(image, gain_addr, 2, calibration[ch].gain[range]);
+	add_write(image, zero_addr, 2, calibration[ch].comp[range]);
+
+	image.channel_reg[ch] = reg;
+	image.channel_range[ch] = range;
+}
+
+void Driver::compile_sampling_config(int32_t rate, bool peak_detect, bool roll, RegisterImage& image) const
 {
+	// Roll mode only makes sense on slow sample rates, otherwise the device
+	// would fill its memory faster than we can poll it
+	image.roll_mode = roll && rate <= ROLL_MODE_MAX_RATE;
+
 	// Send sample rate (This is always a whole number under our program)
-	int32_t timebase = 100000000 / rate;
-	send_command<int32_t>(CMD_SET_TIMEBASE, timebase);
-	// TODO: Disable roll-mode, not supported for now (we don't use very low sample rates)
-	send_command<uint8_t>(CMD_SET_ROLLMODE, 0);
+	add_write(image, CMD_SET_TIMEBASE, 4, static_cast<uint32_t>(100000000 / rate));
+	add_write(image, CMD_SET_ROLLMODE, 1, image.roll_mode ? 1u : 0u);
 	// Set peak detect as desired
-	send_command<uint8_t>(CMD_SET_PEAKMODE, peak_detect ? 1 : 0);
+	add_write(image, CMD_SET_PEAKMODE, 1, peak_detect ? 1u : 0u);
 }
 
-void Driver::push_trigger_config(TriggerConfig config)
+void Driver::compile_trigger_config(const TriggerConfig& config, RegisterImage& image) const
 {
-	send_command<uint16_t>(CMD_SET_MULTI, config.kind == TriggerConfig::EXT ? 2 : 0);
+	add_write(image, CMD_SET_MULTI, 2, config.kind == TriggerConfig::EXT ? 2 : 0);
 
 	// Send trigger pos in samples
 
 }
 
+void Driver::compile_image(const size_t ranges[2], int32_t srate, bool peak_detect, bool roll,
+	const TriggerConfig& trigger, RegisterImage& image) const
+{
+	image = RegisterImage{};
+	for(uint8_t ch = 0; ch < 2; ch++)
+	{
+		compile_channel_range(ch, ranges[ch] < NUM_RANGES ? ranges[ch] : NUM_RANGES - 1, image);
+	}
+	compile_sampling_config(srate, peak_detect, roll, image);
+	compile_trigger_config(trigger, image);
+}
+
+Driver::RegisterWrite* Driver::find_shadow(uint32_t addr)
+{
+	for(size_t i = 0; i < num_shadow; i++)
+	{
+		if(shadow[i].addr == addr)
+		{
+			return &shadow[i];
+		}
+	}
+	return nullptr;
+}
+
+bool Driver::push_image(const RegisterImage& image, size_t& written)
+{
+	RegisterWrite changed[RegisterImage::MAX_WRITES];
+	written = 0;
+	for(size_t i = 0; i < image.count; i++)
+	{
+		const RegisterWrite& write = image.writes[i];
+		const RegisterWrite* last = find_shadow(write.addr);
+		if(last == nullptr || last->size != write.size || last->data != write.data)
+		{
+			changed[written++] = write;
+		}
+	}
+
+	if(written > 0 && !send_batch(changed, written))
+	{
+		// The shadow is gone, so the next image is written whole
+		return false;
+	}
+
+	for(size_t ch = 0; ch < 2; ch++)
+	{
+		channel_reg[ch] = image.channel_reg[ch];
+		channel_range[ch] = image.channel_range[ch];
+	}
+	roll_mode = image.roll_mode;
+	return true;
+}
+
+bool Driver::push_channel_range(uint8_t ch, size_t range)
+{
+	if(ch > 1 || range >= NUM_RANGES)
+	{
+		return false;
+	}
+
+	RegisterImage image{};
+	compile_channel_range(ch, range, image);
+	if(!send_batch(image.writes, image.count))
+	{
+		return false;
+	}
+
+	channel_reg[ch] = image.channel_reg[ch];
+	channel_range[ch] = range;
+	return true;
+}
+
+bool Driver::push_sampling_config(int32_t rate, bool peak_detect, bool roll)
+{
+	RegisterImage image{};
+	compile_sampling_config(rate, peak_detect, roll, image);
+	if(!send_batch(image.writes, image.count))
+	{
+		return false;
+	}
+
+	roll_mode = image.roll_mode;
+	return true;
+}
+
+bool Driver::push_trigger_config(TriggerConfig config)
+{
+	RegisterImage image{};
+	compile_trigger_config(config, image);
+	return send_batch(image.writes, image.count);
+}
+
+
+Driver::AcquisitionState Driver::get_acquisition_state()
+{
+	AcquisitionState state{};
+	// One bit per channel, or both for the external trigger
+	state.triggered = (send_command<uint8_t>(CMD_GET_TRIGGERED, 0).value & 0x03) != 0;
+	state.finished = send_command<uint8_t>(CMD_GET_DATAFINISHED, 0).value == 0;
+	return state;
+}
 
 Driver::DataReadResult Driver::get_data(AcquiredData& out_ch1, AcquiredData& out_ch2, unsigned int timeout)
 {
 	uint16_t channel_set = 0x0505;
 	send_command_raw<uint16_t>(CMD_GET_DATA, channel_set);
 
-	std::array<uint8_t, 5211 * 2> read_bytes{};
 	int read_bytes_num;
-	int ret  = libusb_bulk_transfer(hnd, read_ep, read_bytes.data(), read_bytes.size(), &read_bytes_num, timeout);
+	read_size = 0;
+	int ret  = libusb_bulk_transfer(hnd, read_ep, read_buffer, READ_BUFFER_SIZE, &read_bytes_num, timeout);
 	if(ret == LIBUSB_ERROR_TIMEOUT)
 	{
 		return DataReadResult{.kind = DataReadResult::TIMEOUT};
@@ -277,29 +532,61 @@ Driver::DataReadResult Driver::get_data(AcquiredData& out_ch1, AcquiredData& out
 		return DataReadResult{.kind = DataReadResult::NO_DATA};
 	}
 
-	if(read_bytes_num < 5211)
+	if(read_bytes_num < static_cast<int>(DATA_BLOCK_SIZE))
 	{
 		// Something's wrong
 		return DataReadResult{.kind = DataReadResult::ERROR};
 	}
 
-	printf("Decoded\n");
-
-	return decode_data(read_bytes.data(), read_bytes_num, out_ch1, out_ch2);
+	read_size = read_bytes_num;
+	return decode_data(read_buffer, read_bytes_num, out_ch1, out_ch2);
 
 }
 
-Driver::DataReadResult Driver::decode_data(uint8_t* raw, int num_bytes, AcquiredData& out_ch1, AcquiredData& out_ch2)
+Driver::DataReadResult Driver::decode_data(const uint8_t* raw, int num_bytes, AcquiredData& out_ch1, AcquiredData& out_ch2)
 {
 	DataReadResult res{};
 	res.kind = DataReadResult::OKAY;
 
+	// Each enabled channel comes as its own 5211 byte block:
 	// First byte is channel num
 	// 4-byte uint represents time sum
 	// 4-byte uint represents period number
 	// 2-byte uint represents cursor, starting from right
 	// 100 bytes of trigger buffer
 	// 5100 bytes of ADC data
+	for(int offset = 0; offset + static_cast<int>(DATA_BLOCK_SIZE) <= num_bytes; offset += DATA_BLOCK_SIZE)
+	{
+		const uint8_t* block = raw + offset;
+
+		AcquiredData* out;
+		if(block[0] == 0x00)
+		{
+			out = &out_ch1;
+			res.has_ch1 = true;
+		}
+		else if(block[0] == 0x01)
+		{
+			out = &out_ch2;
+			res.has_ch2 = true;
+		}
+		else
+		{
+			LogWarning("Unknown channel %d in acquired data\n", block[0]);
+			continue;
+		}
+
+		out->time_sum = read_le(block + 1, 4);
+		out->period_num = read_le(block + 5, 4);
+		out->cursor = read_le(block + 9, 2);
+		std::memcpy(out->trigger_buf.data(), block + 11, out->trigger_buf.size());
+		std::memcpy(out->samples.data(), block + 111, out->samples.size());
+	}
+
+	if(!res.has_ch1 && !res.has_ch2)
+	{
+		res.kind = DataReadResult::ERROR;
+	}
 
 	return res;
 }
@@ -310,6 +597,9 @@ void Driver::load_default_settings()
 	// seems to set the oscilloscope in a pretty sane starting
 	// state!
 
+	// Written one by one, and some of them twice
+	num_shadow = 0;
+
 	// TODO: Use value from calibration
 	send_command<uint16_t>(CMD_SET_PHASEFINE, 0);
 	send_command<uint16_t>(CMD_SET_TRIGGER, 0);
@@ -4,6 +4,8 @@
 #include <libusb.h>
 #include <vector>
 
+#include "BufferPool.h"
+
 // Reverse engineering from https://github.com/florentbr/OWON-VDS1022/tree/master
 // and some performed by myself by inspecting USB packets
 // Everything is little endian,
@@ -86,6 +88,14 @@ struct TriggerConfig
 
 };
 
+// ADC codes in trigger_buf and samples are really signed 8-bit values,
+// with 0 at the center of the screen, and 25 codes per vertical division
+// (10 divisions being the full scale range)
+static const double ADC_CODES_PER_RANGE = 250.0;
+
+// Bytes of each channel's block in the reply to CMD_GET_DATA
+static const size_t DATA_BLOCK_SIZE = 5211;
+
 struct AcquiredData
 {
 	uint32_t time_sum;
@@ -109,6 +119,19 @@ protected:
 
 	Calibration calibration[2];
 
+	bool roll_mode;
+
+	// Last value written to CMD_SET_CHANNEL_CHx, and the calibrated range in use
+	uint8_t channel_reg[2];
+	size_t channel_range[2];
+
+	// Reply to the last CMD_GET_DATA, as read from the device. Bulk transfers
+	// land straight in it, so it comes from an aligned pool of its own.
+	static const size_t READ_BUFFER_SIZE = DATA_BLOCK_SIZE * 2;
+	BufferPool transfer_pool;
+	uint8_t* read_buffer;
+	int read_size;
+
 	// T may be uint8_t, uint16_t or uint32_t
 	// BEWARE! The type of T is vital for the command success!
 	template<typename T>
@@ -120,6 +143,9 @@ protected:
 
 	CommandResponse receive_response() const;
 
+	// addr, size and data as for send_command, little endian
+	static size_t encode_command(uint8_t* out, uint32_t addr, uint8_t size, uint32_t data);
+
 	// Obtains current oscilloscope calibration, and returns
 	// if everything is safe to use
 	bool read_flash();
@@ -128,8 +154,68 @@ protected:
 
 public:
 
-	void push_sampling_config(int32_t srate, bool peak_detect);
-	void push_trigger_config(TriggerConfig config);
+	// Sample rates at or below this are slow enough for the device to stream
+	// samples as they are taken (roll mode) instead of filling its memory first
+	static constexpr int32_t ROLL_MODE_MAX_RATE = 5000;
+
+	// Volts per division of each calibrated range, as indexed in Calibration
+	static const size_t NUM_RANGES = 10;
+	static const double RANGE_VOLTS_DIV[NUM_RANGES];
+	// Vertical divisions over the full scale of a channel
+	static constexpr double NUM_DIVISIONS = 10.0;
+
+	// Sample rates the timebase divider can do exactly, ascending
+	static const size_t NUM_SAMPLE_RATES = 20;
+	static const int32_t SAMPLE_RATES[NUM_SAMPLE_RATES];
+
+	Driver();
+
+	struct RegisterWrite
+	{
+		uint32_t addr;
+		// 1, 2 or 4 bytes, see send_command
+		uint8_t size;
+		uint32_t data;
+	};
+	// Sends every write before reading any reply, so the device turnarounds
+	// overlap instead of adding up. Stops at the first write that fails, and
+	// returns false if any transfer failed or a reply didn't come in time.
+	static constexpr unsigned int BATCH_REPLY_TIMEOUT_MS = 1000;
+	bool send_batch(const RegisterWrite* writes, size_t count);
+
+	// A whole setup (both channels' range and calibration, sampling and
+	// trigger) as the register writes it takes, so that switching to it is a
+	// single batch with nothing left to work out
+	struct RegisterImage
+	{
+		static const size_t MAX_WRITES = 16;
+		RegisterWrite writes[MAX_WRITES];
+		size_t count;
+		// Driver state going with the registers
+		uint8_t channel_reg[2];
+		size_t channel_range[2];
+		bool roll_mode;
+	};
+	// Uses the calibration and the coupling / on-off of the channels as they are now
+	void compile_image(const size_t ranges[2], int32_t srate, bool peak_detect, bool roll,
+		const TriggerConfig& trigger, RegisterImage& image) const;
+	// Only writes the registers whose value differs from the last one written,
+	// in a single batch. written is how many that took. On failure the driver
+	// state is left as it was.
+	bool push_image(const RegisterImage& image, size_t& written);
+
+	// Smallest calibrated range showing volts_div (or the largest one)
+	static size_t find_range(double volts_div);
+	// Fastest of SAMPLE_RATES not over rate_hz, 0 if it's below all of them
+	static int32_t find_sample_rate(uint64_t rate_hz);
+	// Range, gain and offset calibration of a channel, in a single batch.
+	// These return false, with the driver state left as it was, if the batch failed.
+	bool push_channel_range(uint8_t ch, size_t range);
+	size_t get_channel_range(uint8_t ch) const { return channel_range[ch]; }
+
+	bool push_sampling_config(int32_t srate, bool peak_detect, bool roll);
+	bool is_roll_mode() const { return roll_mode; }
+	bool push_trigger_config(TriggerConfig config);
 
 	struct DataReadResult
 	{
@@ -144,13 +230,24 @@ public:
 		bool has_ch1;
 		bool has_ch2;
 	};
+	struct AcquisitionState
+	{
+		bool triggered;
+		bool finished;
+	};
+	// CMD_GET_TRIGGERED then CMD_GET_DATAFINISHED, for timing the phases of an
+	// acquisition. Two more round trips per poll, so only when asked for.
+	AcquisitionState get_acquisition_state();
+
 	// timeout in ms, use 0 for no timeout. Returns:
 	// 0 if no new data was available (timed-out or error)
 	// 1 if data was written to ch1
 	// 2 if data was written to ch2
 	// 3 if data was written to both
 	DataReadResult get_data(AcquiredData& out_ch1, AcquiredData& out_ch2, unsigned int timeout);
-	DataReadResult decode_data(uint8_t* raw, int num_bytes, AcquiredData& out_ch1, AcquiredData& out_ch2);
+	// Raw bytes behind the last successful get_data(), valid until the next call
+	const uint8_t* get_raw_data(size_t& size) const { size = static_cast<size_t>(read_size); return read_buffer; }
+	DataReadResult decode_data(const uint8_t* raw, int num_bytes, AcquiredData& out_ch1, AcquiredData& out_ch2);
 
 	void load_default_settings();
 
@@ -158,5 +255,20 @@ public:
 	bool init(libusb_device_handle* _hnd, uint8_t _write_ep, uint8_t _read_ep);
 
 	void deinit();
+
+protected:
+
+	// Parts of an image, also what push_channel_range() and the others send
+	void compile_channel_range(uint8_t ch, size_t range, RegisterImage& image) const;
+	void compile_sampling_config(int32_t srate, bool peak_detect, bool roll, RegisterImage& image) const;
+	void compile_trigger_config(const TriggerConfig& config, RegisterImage& image) const;
+
+	// Last value written to each register through send_batch(), for
+	// push_image() to skip those already set. Forgotten whenever the device
+	// state is unsure: on a failed batch, or when reset to the defaults.
+	static const size_t MAX_SHADOW = 32;
+	RegisterWrite shadow[MAX_SHADOW];
+	size_t num_shadow;
+	RegisterWrite* find_shadow(uint32_t addr);
 };
 
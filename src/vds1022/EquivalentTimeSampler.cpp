@@ -0,0 +1,130 @@
+#include "EquivalentTimeSampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Samples of the ADC buffer actually shown, skipping the 50 pre / post samples
+static const size_t FIRST_SAMPLE = 50;
+static const size_t NUM_SAMPLES = 5000;
+
+EquivalentTimeSampler::EquivalentTimeSampler()
+:	factor(1)
+,	level(0)
+,	rising(true)
+,	frames(0)
+,	rejected(0)
+,	filled_bins(0)
+{
+}
+
+void EquivalentTimeSampler::configure(uint32_t _factor, int8_t _level, bool _rising)
+{
+	if(_factor < 1)
+	{
+		_factor = 1;
+	}
+	else if(_factor > MAX_FACTOR)
+	{
+		_factor = MAX_FACTOR;
+	}
+
+	factor = _factor;
+	level = _level;
+	rising = _rising;
+
+	sums.assign(NUM_SAMPLES * factor, 0);
+	counts.assign(NUM_SAMPLES * factor, 0);
+	reset();
+}
+
+void EquivalentTimeSampler::reset()
+{
+	std::fill(sums.begin(), sums.end(), 0);
+	std::fill(counts.begin(), counts.end(), 0);
+	frames = 0;
+	rejected = 0;
+	filled_bins = 0;
+}
+
+float EquivalentTimeSampler::find_trigger_phase(const AcquiredData& data, int8_t level, bool rising)
+{
+	const auto& buf = data.trigger_buf;
+	const float center = buf.size() / 2.0f;
+
+	float best = -1.0f;
+	float best_dist = center + 1.0f;
+	for(size_t i = 0; i + 1 < buf.size(); i++)
+	{
+		float a = static_cast<int8_t>(buf[i]);
+		float b = static_cast<int8_t>(buf[i + 1]);
+
+		bool crosses = rising ? (a < level && b >= level) : (a > level && b <= level);
+		if(!crosses)
+		{
+			continue;
+		}
+
+		float pos = i + (level - a) / (b - a);
+		float dist = std::fabs(pos - center);
+		if(dist < best_dist)
+		{
+			best = pos;
+			best_dist = dist;
+		}
+	}
+
+	return best;
+}
+
+bool EquivalentTimeSampler::push_frame(const AcquiredData& data)
+{
+	float pos = find_trigger_phase(data, level, rising);
+	if(pos < 0.0f || sums.empty())
+	{
+		rejected++;
+		return false;
+	}
+
+	// Cursor gives where the trigger landed in the sample buffer (counting from
+	// the right), trigger_buf gives the fractional part. Samples are placed
+	// so the trigger always lands on bin 0 of the center sample.
+	float phase = pos - std::floor(pos);
+	int32_t trig_idx = static_cast<int32_t>(data.samples.size()) - static_cast<int32_t>(data.cursor);
+	int32_t shift = static_cast<int32_t>(FIRST_SAMPLE + NUM_SAMPLES / 2) - trig_idx;
+
+	uint32_t sub = static_cast<uint32_t>((1.0f - phase) * factor);
+	if(sub >= factor)
+	{
+		sub = factor - 1;
+	}
+
+	int32_t first = shift < 0 ? -shift : 0;
+	int32_t last = static_cast<int32_t>(NUM_SAMPLES) - (shift > 0 ? shift : 0);
+	for(int32_t i = first; i < last; i++)
+	{
+		size_t bin = static_cast<size_t>(i + shift) * factor + sub;
+		sums[bin] += static_cast<int8_t>(data.samples[FIRST_SAMPLE + i]);
+		if(counts[bin]++ == 0)
+		{
+			filled_bins++;
+		}
+	}
+
+	frames++;
+	return true;
+}
+
+void EquivalentTimeSampler::reconstruct(int16_t* values, uint8_t* fill) const
+{
+	int16_t prev = 0;
+	for(size_t i = 0; i < sums.size(); i++)
+	{
+		uint32_t count = counts[i];
+		if(count > 0)
+		{
+			prev = static_cast<int16_t>((static_cast<int64_t>(sums[i]) * 256) / count);
+		}
+		values[i] = prev;
+		fill[i] = count > 255 ? 255 : static_cast<uint8_t>(count);
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Driver.h"
+
+// Reconstructs a repetitive signal at factor times the real sample rate.
+// Every frame is aligned on its trigger with sub-sample precision, found by
+// interpolating the level crossing in trigger_buf, and its samples are
+// added into the bins of a finer time grid. Bins are updated on each frame,
+// so the result gets more complete as frames come in.
+class EquivalentTimeSampler
+{
+public:
+	static constexpr uint32_t MAX_FACTOR = 64;
+
+	EquivalentTimeSampler();
+
+	// Also clears all accumulated data
+	void configure(uint32_t factor, int8_t level, bool rising);
+	void reset();
+
+	// Returns false if the frame had no usable trigger crossing and was dropped
+	bool push_frame(const AcquiredData& data);
+
+	// Averaged value of each bin in 1/256 of an ADC code, and how many samples
+	// fell in it (saturated to 255). Empty bins are filled from the previous
+	// non-empty one so the output is always drawable.
+	void reconstruct(int16_t* values, uint8_t* fill) const;
+
+	uint32_t get_factor() const { return factor; }
+	int8_t get_level() const { return level; }
+	bool is_rising() const { return rising; }
+	size_t get_num_bins() const { return sums.size(); }
+	uint32_t get_frames() const { return frames; }
+	uint32_t get_rejected() const { return rejected; }
+	uint32_t get_filled_bins() const { return filled_bins; }
+
+	// Sub-sample position of the trigger crossing closest to the center
+	// of trigger_buf, or a negative value if there's none
+	static float find_trigger_phase(const AcquiredData& data, int8_t level, bool rising);
+
+protected:
+
+	uint32_t factor;
+	int8_t level;
+	bool rising;
+
+	std::vector<int32_t> sums;
+	std::vector<uint32_t> counts;
+
+	uint32_t frames;
+	uint32_t rejected;
+	uint32_t filled_bins;
+};
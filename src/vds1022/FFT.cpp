@@ -0,0 +1,115 @@
+#include "FFT.h"
+
+#include <cmath>
+#include <map>
+#include <mutex>
+
+FFTPlan::FFTPlan(size_t _n)
+:	n(_n)
+,	half(_n / 2)
+{
+	size_t bits = 0;
+	while((static_cast<size_t>(1) << bits) < half)
+	{
+		bits++;
+	}
+
+	bitrev.resize(half);
+	for(size_t i = 0; i < half; i++)
+	{
+		uint32_t r = 0;
+		for(size_t b = 0; b < bits; b++)
+		{
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		bitrev[i] = r;
+	}
+
+	for(size_t len = 2; len <= half; len *= 2)
+	{
+		for(size_t k = 0; k < len / 2; k++)
+		{
+			double angle = -2.0 * M_PI * k / len;
+			stage_cos.push_back(static_cast<float>(std::cos(angle)));
+			stage_sin.push_back(static_cast<float>(std::sin(angle)));
+		}
+	}
+
+	split_cos.resize(half + 1);
+	split_sin.resize(half + 1);
+	for(size_t k = 0; k <= half; k++)
+	{
+		double angle = -2.0 * M_PI * k / n;
+		split_cos[k] = static_cast<float>(std::cos(angle));
+		split_sin[k] = static_cast<float>(std::sin(angle));
+	}
+}
+
+std::shared_ptr<const FFTPlan> FFTPlan::get(size_t n)
+{
+	static std::mutex mtx;
+	static std::map<size_t, std::shared_ptr<const FFTPlan>> cache;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = cache.find(n);
+	if(it != cache.end())
+	{
+		return it->second;
+	}
+
+	auto plan = std::make_shared<const FFTPlan>(n);
+	cache[n] = plan;
+	return plan;
+}
+
+void FFTPlan::forward(const float* in, float* re, float* im, float* zr, float* zi) const
+{
+	// Pack even samples as real and odd ones as imaginary part, in bit reversed order
+	for(size_t i = 0; i < half; i++)
+	{
+		uint32_t j = bitrev[i];
+		zr[j] = in[2 * i];
+		zi[j] = in[2 * i + 1];
+	}
+
+	// Iterative radix-2
+	const float* tc = stage_cos.data();
+	const float* ts = stage_sin.data();
+	for(size_t len = 2; len <= half; len *= 2)
+	{
+		const size_t h = len / 2;
+		for(size_t base = 0; base < half; base += len)
+		{
+			float* ar = zr + base;
+			float* ai = zi + base;
+			float* br = zr + base + h;
+			float* bi = zi + base + h;
+			for(size_t k = 0; k < h; k++)
+			{
+				float tr = br[k] * tc[k] - bi[k] * ts[k];
+				float ti = br[k] * ts[k] + bi[k] * tc[k];
+				br[k] = ar[k] - tr;
+				bi[k] = ai[k] - ti;
+				ar[k] += tr;
+				ai[k] += ti;
+			}
+		}
+		tc += h;
+		ts += h;
+	}
+
+	// Split the half size transform into the spectrum of the real input
+	for(size_t k = 0; k <= half; k++)
+	{
+		size_t a = k % half;
+		size_t b = (half - k) % half;
+
+		float er = 0.5f * (zr[a] + zr[b]);
+		float ei = 0.5f * (zi[a] - zi[b]);
+		float orr = 0.5f * (zi[a] + zi[b]);
+		float oi = -0.5f * (zr[a] - zr[b]);
+
+		re[k] = er + orr * split_cos[k] - oi * split_sin[k];
+		im[k] = ei + orr * split_sin[k] + oi * split_cos[k];
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Real to complex FFT of a power of two size, computed as a complex FFT of
+// half the size plus a split pass. Plans hold every table the transform
+// needs (bit reversal, and the twiddles of each stage laid out
+// contiguously so the butterfly loops vectorize) and are cached, so they
+// are only built once per size.
+class FFTPlan
+{
+public:
+	explicit FFTPlan(size_t n);
+
+	// Plans are shared between every user of a given size
+	static std::shared_ptr<const FFTPlan> get(size_t n);
+
+	size_t get_size() const { return n; }
+
+	// in has n real samples, re / im get n / 2 + 1 bins.
+	// scratch_re / scratch_im must hold n / 2 values each.
+	void forward(const float* in, float* re, float* im, float* scratch_re, float* scratch_im) const;
+
+protected:
+
+	size_t n;
+	size_t half;
+
+	std::vector<uint32_t> bitrev;
+	// cos / -sin of each butterfly, stage after stage
+	std::vector<float> stage_cos;
+	std::vector<float> stage_sin;
+	// Twiddles for the split pass
+	std::vector<float> split_cos;
+	std::vector<float> split_sin;
+};
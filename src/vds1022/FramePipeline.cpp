@@ -0,0 +1,248 @@
+#include "FramePipeline.h"
+
+#include <cstdint>
+#include <new>
+
+FramePipeline::FramePipeline(size_t num_frames, TaskPool* task_pool)
+:	pool(task_pool != nullptr ? *task_pool : TaskPool::get())
+,	frame_pool(sizeof(PipelineFrame), num_frames)
+,	next_seq(0)
+,	done(num_frames, nullptr)
+,	next_deliver(0)
+,	delivering(false)
+,	delivered(0)
+{
+	for(size_t i = 0; i < num_frames; i++)
+	{
+		PipelineFrame* frame = new(frame_pool.get(i)) PipelineFrame();
+		frame->slot = i;
+		frames.push_back(frame);
+		free_frames.push_back(frame);
+	}
+}
+
+FramePipeline::~FramePipeline()
+{
+	flush();
+	for(PipelineFrame* frame : frames)
+	{
+		frame->~PipelineFrame();
+	}
+}
+
+void FramePipeline::reserve_packets(size_t stage, size_t bytes)
+{
+	for(PipelineFrame* frame : frames)
+	{
+		frame->packets[stage][0].reserve(bytes);
+		frame->packets[stage][1].reserve(bytes);
+	}
+}
+
+size_t FramePipeline::add_stage(const std::string& name, StageFunc func, const std::vector<size_t>& deps, bool ordered)
+{
+	size_t index = stages.size();
+	if(index >= PipelineFrame::MAX_STAGES)
+	{
+		return SIZE_MAX;
+	}
+
+	Stage stage;
+	stage.name = name;
+	stage.func = func;
+	stage.num_deps = static_cast<uint32_t>(deps.size());
+	stage.ordered = ordered;
+	stages.push_back(stage);
+	for(size_t dep : deps)
+	{
+		stages[dep].dependents.push_back(index);
+	}
+
+	for(uint8_t ch = 0; ch < 2; ch++)
+	{
+		gates.emplace_back(new Gate());
+		gates.back()->next_seq = 0;
+		gates.back()->parked.resize(frames.size(), nullptr);
+	}
+	return index;
+}
+
+PipelineFrame* FramePipeline::acquire(unsigned int timeout_ms)
+{
+	std::unique_lock<std::mutex> lock(free_mtx);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while(free_frames.empty())
+	{
+		if(timeout_ms == 0)
+		{
+			free_cond.wait(lock);
+		}
+		else if(free_cond.wait_until(lock, deadline) == std::cv_status::timeout && free_frames.empty())
+		{
+			return nullptr;
+		}
+	}
+	PipelineFrame* frame = free_frames.back();
+	free_frames.pop_back();
+	return frame;
+}
+
+void FramePipeline::release(PipelineFrame* frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(free_mtx);
+		free_frames.push_back(frame);
+	}
+	free_cond.notify_all();
+}
+
+void FramePipeline::submit(PipelineFrame* frame)
+{
+	// Only ever called from the acquisition thread, so no need for locking
+	frame->seq = next_seq++;
+	frame->wanted = admit ? admit(*frame) : true;
+	for(size_t s = 0; s < stages.size(); s++)
+	{
+		for(uint8_t ch = 0; ch < 2; ch++)
+		{
+			frame->deps_left[s][ch] = stages[s].num_deps;
+			frame->packets[s][ch].clear();
+		}
+	}
+	frame->tasks_left = static_cast<uint32_t>(stages.size() * 2);
+
+	if(stages.empty())
+	{
+		complete(frame);
+		return;
+	}
+
+	for(size_t s = 0; s < stages.size(); s++)
+	{
+		if(stages[s].num_deps == 0)
+		{
+			schedule(frame, s, 0);
+			schedule(frame, s, 1);
+		}
+	}
+}
+
+void FramePipeline::flush()
+{
+	std::unique_lock<std::mutex> lock(free_mtx);
+	while(free_frames.size() < frames.size())
+	{
+		free_cond.wait(lock);
+	}
+	lock.unlock();
+
+	// The last frame is released before whoever delivered it is done with the pipeline
+	std::unique_lock<std::mutex> deliver_lock(deliver_mtx);
+	while(delivering)
+	{
+		deliver_idle.wait(deliver_lock);
+	}
+}
+
+void FramePipeline::run_task(void* ctx, uintptr_t arg)
+{
+	FramePipeline* pipeline = static_cast<FramePipeline*>(ctx);
+	pipeline->ready(pipeline->frames[arg >> 4], (arg >> 1) & 7, arg & 1);
+}
+
+void FramePipeline::schedule(PipelineFrame* frame, size_t stage, uint8_t ch)
+{
+	pool.submit(&FramePipeline::run_task, this, (frame->slot << 4) | (stage << 1) | ch);
+}
+
+void FramePipeline::ready(PipelineFrame* frame, size_t stage, uint8_t ch)
+{
+	if(stages[stage].ordered)
+	{
+		// Only the frame whose turn it is may run, the others wait for it to be done
+		Gate& gate = *gates[stage * 2 + ch];
+		std::lock_guard<std::mutex> lock(gate.mtx);
+		if(frame->seq != gate.next_seq)
+		{
+			gate.parked[frame->seq % frames.size()] = frame;
+			return;
+		}
+	}
+
+	execute(frame, stage, ch);
+}
+
+void FramePipeline::execute(PipelineFrame* frame, size_t stage, uint8_t ch)
+{
+	const Stage& st = stages[stage];
+	st.func(*frame, ch);
+
+	for(size_t dependent : st.dependents)
+	{
+		if(--frame->deps_left[dependent][ch] == 0)
+		{
+			schedule(frame, dependent, ch);
+		}
+	}
+
+	if(st.ordered)
+	{
+		PipelineFrame* next;
+		{
+			Gate& gate = *gates[stage * 2 + ch];
+			std::lock_guard<std::mutex> lock(gate.mtx);
+			gate.next_seq++;
+			PipelineFrame*& parked = gate.parked[gate.next_seq % frames.size()];
+			next = parked;
+			parked = nullptr;
+		}
+		if(next != nullptr)
+		{
+			schedule(next, stage, ch);
+		}
+	}
+
+	if(--frame->tasks_left == 0)
+	{
+		complete(frame);
+	}
+}
+
+void FramePipeline::complete(PipelineFrame* frame)
+{
+	std::unique_lock<std::mutex> lock(deliver_mtx);
+	done[frame->seq % frames.size()] = frame;
+
+	// Whoever is delivering already will get to this one
+	if(delivering)
+	{
+		return;
+	}
+
+	delivering = true;
+	while(true)
+	{
+		PipelineFrame*& slot = done[next_deliver % frames.size()];
+		PipelineFrame* next = slot;
+		if(next == nullptr)
+		{
+			break;
+		}
+		slot = nullptr;
+		next_deliver++;
+
+		lock.unlock();
+		delivered++;
+		if(deliver)
+		{
+			deliver(*next);
+		}
+		else
+		{
+			release(next);
+		}
+		lock.lock();
+	}
+	delivering = false;
+	deliver_idle.notify_all();
+}
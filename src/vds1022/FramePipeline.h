@@ -0,0 +1,150 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BufferPool.h"
+#include "DeadTimeAnalyzer.h"
+#include "Driver.h"
+#include "MeasurementEngine.h"
+#include "TaskPool.h"
+
+// One acquisition on its way through the pipeline. Frames are allocated once,
+// from a BufferPool, and recycled. Buffers inside keep their capacity from
+// one use to the next.
+struct PipelineFrame
+{
+	static constexpr size_t MAX_STAGES = 8;
+
+	AcquiredData data[2];
+	bool has_ch[2];
+	bool roll;
+	// Settings the frame was acquired with
+	uint32_t generation;
+	uint64_t sample_rate;
+	// Calibrated ranges, see Driver::RANGE_VOLTS_DIV
+	size_t ranges[2];
+	std::chrono::steady_clock::time_point read_time;
+	// Acquisition cycle the frame came from, transferred being read_time
+	AcquisitionTimes times;
+	// False if nobody will receive the results, see set_admit()
+	bool wanted;
+
+	// Results passed from one stage to the ones depending on it
+	FrameMeasurements measurements[2];
+	uint16_t roll_samples[2];
+
+	// Packets produced by each stage for each channel
+	std::vector<uint8_t> packets[MAX_STAGES][2];
+
+protected:
+	friend class FramePipeline;
+
+	uint64_t seq;
+	size_t slot;
+	std::atomic<uint32_t> deps_left[MAX_STAGES][2];
+	std::atomic<uint32_t> tasks_left;
+};
+
+// Runs the processing of frames as a DAG of stages on the shared task pool.
+// Each stage runs once per frame and channel, as soon as the stages it
+// depends on are done for that channel. Different frames, channels and
+// devices are processed in parallel.
+//
+// Stages holding state from one frame to the next are "ordered": for a given
+// channel they see the frames one at a time and in acquisition order. Frames
+// are handed to the deliver callback in acquisition order too, one at a time.
+// The callback owns the frame from then on and must release() it when done.
+// Without a callback frames are released as soon as they are processed.
+class FramePipeline
+{
+public:
+	typedef std::function<void(PipelineFrame& frame, uint8_t ch)> StageFunc;
+	typedef std::function<void(PipelineFrame& frame)> DeliverFunc;
+	typedef std::function<bool(PipelineFrame& frame)> AdmitFunc;
+
+	explicit FramePipeline(size_t num_frames = 8, TaskPool* pool = nullptr);
+	~FramePipeline();
+
+	// Stages must be added before the first frame, after the ones they depend on.
+	// Returns the index of the stage, which is also its index in packets.
+	size_t add_stage(const std::string& name, StageFunc func, const std::vector<size_t>& deps, bool ordered);
+	void set_deliver(DeliverFunc func) { deliver = func; }
+	// Decides whether a frame is wanted, called by submit() in acquisition order.
+	// Unwanted frames still go through every stage, so that stages keeping state
+	// see all of them, but the others may skip their work.
+	void set_admit(AdmitFunc func) { admit = func; }
+
+	// Gives the packets of a stage that much capacity up front, so that the
+	// first frames through don't have to allocate
+	void reserve_packets(size_t stage, size_t bytes);
+
+	size_t get_num_stages() const { return stages.size(); }
+	const std::string& get_stage_name(size_t stage) const { return stages[stage].name; }
+
+	// Waits up to timeout_ms (0 for ever) for a frame to be free, nullptr if
+	// none was. This is what bounds the frames in flight.
+	PipelineFrame* acquire(unsigned int timeout_ms = 0);
+	// Returns a frame that was delivered, or acquired but won't be submitted
+	void release(PipelineFrame* frame);
+	// Starts processing a frame, which comes back through deliver
+	void submit(PipelineFrame* frame);
+
+	// Waits until all frames were delivered and released
+	void flush();
+
+	uint64_t get_delivered() const { return delivered; }
+
+protected:
+
+	struct Stage
+	{
+		std::string name;
+		StageFunc func;
+		std::vector<size_t> dependents;
+		uint32_t num_deps;
+		bool ordered;
+	};
+
+	// Lets an ordered stage run the frames of a channel in sequence
+	struct Gate
+	{
+		std::mutex mtx;
+		uint64_t next_seq;
+		// Frames whose turn hasn't come yet, indexed by seq % num_frames
+		std::vector<PipelineFrame*> parked;
+	};
+
+	static void run_task(void* ctx, uintptr_t arg);
+	void schedule(PipelineFrame* frame, size_t stage, uint8_t ch);
+	void ready(PipelineFrame* frame, size_t stage, uint8_t ch);
+	void execute(PipelineFrame* frame, size_t stage, uint8_t ch);
+	void complete(PipelineFrame* frame);
+
+	TaskPool& pool;
+	BufferPool frame_pool;
+	std::vector<PipelineFrame*> frames;
+	std::vector<Stage> stages;
+	std::vector<std::unique_ptr<Gate>> gates;
+	DeliverFunc deliver;
+	AdmitFunc admit;
+
+	std::mutex free_mtx;
+	std::condition_variable free_cond;
+	std::vector<PipelineFrame*> free_frames;
+
+	uint64_t next_seq;
+
+	// Frames done but not delivered yet, indexed by seq % num_frames
+	std::mutex deliver_mtx;
+	std::vector<PipelineFrame*> done;
+	uint64_t next_deliver;
+	bool delivering;
+	std::condition_variable deliver_idle;
+	std::atomic<uint64_t> delivered;
+};
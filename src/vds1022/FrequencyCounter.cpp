@@ -0,0 +1,76 @@
+#include "FrequencyCounter.h"
+
+FrequencyCounter::FrequencyCounter()
+:	window(8)
+,	head(0)
+,	count(0)
+,	time_sums{}
+,	period_nums{}
+,	total_time(0)
+,	total_periods(0)
+{
+}
+
+void FrequencyCounter::set_window(size_t frames)
+{
+	if(frames < 1)
+	{
+		frames = 1;
+	}
+	else if(frames > MAX_WINDOW)
+	{
+		frames = MAX_WINDOW;
+	}
+
+	window = frames;
+	reset();
+}
+
+void FrequencyCounter::reset()
+{
+	head = 0;
+	count = 0;
+	total_time = 0;
+	total_periods = 0;
+}
+
+void FrequencyCounter::push_frame(const AcquiredData& data)
+{
+	// Drop the oldest frame once the window is full
+	if(count == window)
+	{
+		total_time -= time_sums[head];
+		total_periods -= period_nums[head];
+	}
+	else
+	{
+		count++;
+	}
+
+	time_sums[head] = data.time_sum;
+	period_nums[head] = data.period_num;
+	total_time += data.time_sum;
+	total_periods += data.period_num;
+
+	head = (head + 1) % window;
+}
+
+double FrequencyCounter::get_frequency() const
+{
+	if(total_time == 0 || total_periods == 0)
+	{
+		return 0.0;
+	}
+
+	return CLOCK_HZ * static_cast<double>(total_periods) / static_cast<double>(total_time);
+}
+
+double FrequencyCounter::get_period() const
+{
+	if(total_time == 0 || total_periods == 0)
+	{
+		return 0.0;
+	}
+
+	return static_cast<double>(total_time) / (CLOCK_HZ * static_cast<double>(total_periods));
+}
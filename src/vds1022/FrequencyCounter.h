@@ -0,0 +1,41 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+#include "Driver.h"
+
+// Frequency meter built from the hardware counters in every frame: the
+// device counts period_num whole periods of the signal over time_sum ticks
+// of its 100MHz clock. Counts are summed over a moving window of frames, so
+// the reading is smoothed without having to look at any samples.
+class FrequencyCounter
+{
+public:
+	static constexpr size_t MAX_WINDOW = 256;
+	static constexpr double CLOCK_HZ = 100e6;
+
+	FrequencyCounter();
+
+	// Also clears the window
+	void set_window(size_t frames);
+	size_t get_window() const { return window; }
+	void reset();
+
+	void push_frame(const AcquiredData& data);
+
+	// 0 if the signal had no whole period in the window
+	double get_frequency() const;
+	double get_period() const;
+
+protected:
+
+	size_t window;
+	size_t head;
+	size_t count;
+
+	std::array<uint32_t, MAX_WINDOW> time_sums;
+	std::array<uint32_t, MAX_WINDOW> period_nums;
+
+	uint64_t total_time;
+	uint64_t total_periods;
+};
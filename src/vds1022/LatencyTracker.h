@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Running statistics of a latency, safe to update and read from any thread
+class LatencyTracker
+{
+public:
+	LatencyTracker()
+	:	last_ns(0)
+	,	max_ns(0)
+	,	sum_ns(0)
+	,	count(0)
+	{
+	}
+
+	void add(uint64_t ns)
+	{
+		last_ns = ns;
+		sum_ns += ns;
+		count++;
+		uint64_t prev = max_ns;
+		while(ns > prev && !max_ns.compare_exchange_weak(prev, ns))
+		{
+		}
+	}
+
+	void reset()
+	{
+		last_ns = 0;
+		max_ns = 0;
+		sum_ns = 0;
+		count = 0;
+	}
+
+	struct Stats
+	{
+		double last_us;
+		double mean_us;
+		double max_us;
+		uint64_t count;
+	};
+
+	Stats get() const
+	{
+		Stats out{};
+		out.count = count;
+		out.last_us = last_ns * 1e-3;
+		out.max_us = max_ns * 1e-3;
+		out.mean_us = out.count > 0 ? (sum_ns * 1e-3) / out.count : 0.0;
+		return out;
+	}
+
+protected:
+
+	std::atomic<uint64_t> last_ns;
+	std::atomic<uint64_t> max_ns;
+	std::atomic<uint64_t> sum_ns;
+	std::atomic<uint64_t> count;
+};
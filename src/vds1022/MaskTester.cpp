@@ -0,0 +1,182 @@
+#include "MaskTester.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static int8_t clamp_code(float code)
+{
+	float r = std::round(code);
+	return static_cast<int8_t>(r < -128.0f ? -128.0f : (r > 127.0f ? 127.0f : r));
+}
+
+// Resamples a table of limits across the whole frame
+static void interpolate_table(const std::vector<float>& table, int8_t* out, size_t n)
+{
+	if(table.empty())
+	{
+		return;
+	}
+
+	for(size_t i = 0; i < n; i++)
+	{
+		float pos = table.size() > 1 ? static_cast<float>(i) * (table.size() - 1) / (n - 1) : 0.0f;
+		size_t a = static_cast<size_t>(pos);
+		size_t b = std::min(a + 1, table.size() - 1);
+		float frac = pos - a;
+		out[i] = clamp_code(table[a] + (table[b] - table[a]) * frac);
+	}
+}
+
+MaskTester::MaskTester()
+:	first_violation(0)
+,	tested(0)
+,	failed(0)
+,	violations(0)
+{
+	clear();
+}
+
+void MaskTester::clear()
+{
+	upper.fill(127);
+	lower.fill(-128);
+}
+
+void MaskTester::set_upper(const std::vector<float>& table)
+{
+	interpolate_table(table, upper.data(), NUM_SAMPLES);
+}
+
+void MaskTester::set_lower(const std::vector<float>& table)
+{
+	interpolate_table(table, lower.data(), NUM_SAMPLES);
+}
+
+bool MaskTester::add_polygon(const std::vector<float>& vertices)
+{
+	size_t n = vertices.size() / 2;
+	if(n < 3 || vertices.size() % 2 != 0)
+	{
+		return false;
+	}
+
+	// Only the limits can be restricted, so it has to reach the top or the bottom
+	float top = -1e9f;
+	float bottom = 1e9f;
+	for(size_t e = 0; e < n; e++)
+	{
+		top = std::max(top, vertices[e * 2 + 1]);
+		bottom = std::min(bottom, vertices[e * 2 + 1]);
+	}
+	if(top < 127.0f && bottom > -128.0f)
+	{
+		return false;
+	}
+
+	for(size_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		// Vertical span of the polygon at this sample
+		float x = static_cast<float>(i);
+		float ymin = 1e9f;
+		float ymax = -1e9f;
+		for(size_t e = 0; e < n; e++)
+		{
+			float x0 = vertices[e * 2];
+			float y0 = vertices[e * 2 + 1];
+			float x1 = vertices[((e + 1) % n) * 2];
+			float y1 = vertices[((e + 1) % n) * 2 + 1];
+			if(x < std::min(x0, x1) || x > std::max(x0, x1))
+			{
+				continue;
+			}
+
+			float y = x0 == x1 ? y0 : y0 + (y1 - y0) * (x - x0) / (x1 - x0);
+			ymin = std::min(ymin, x0 == x1 ? std::min(y0, y1) : y);
+			ymax = std::max(ymax, x0 == x1 ? std::max(y0, y1) : y);
+		}
+
+		if(ymin > ymax)
+		{
+			continue;
+		}
+
+		if(ymin + ymax >= 0.0f)
+		{
+			upper[i] = std::min(upper[i], clamp_code(std::ceil(ymin) - 1.0f));
+		}
+		else
+		{
+			lower[i] = std::max(lower[i], clamp_code(std::floor(ymax) + 1.0f));
+		}
+	}
+	return true;
+}
+
+uint32_t MaskTester::test(const AcquiredData& data)
+{
+	// Skip the 50 pre samples
+	const int8_t* samples = reinterpret_cast<const int8_t*>(data.samples.data() + 50);
+	uint32_t count = 0;
+	first_violation = NUM_SAMPLES;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for(; i + 16 <= NUM_SAMPLES; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+		__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(upper.data() + i));
+		__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lower.data() + i));
+		__m128i bad = _mm_or_si128(_mm_cmpgt_epi8(v, hi), _mm_cmplt_epi8(v, lo));
+		uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(bad));
+		if(mask)
+		{
+			if(count == 0)
+			{
+				first_violation = static_cast<uint32_t>(i + __builtin_ctz(mask));
+			}
+			count += static_cast<uint32_t>(__builtin_popcount(mask));
+		}
+	}
+#endif
+
+	for(; i < NUM_SAMPLES; i++)
+	{
+		if(samples[i] > upper[i] || samples[i] < lower[i])
+		{
+			if(count == 0)
+			{
+				first_violation = static_cast<uint32_t>(i);
+			}
+			count++;
+		}
+	}
+
+	tested++;
+	if(count > 0)
+	{
+		failed++;
+		violations += count;
+	}
+
+	return count;
+}
+
+MaskTester::Stats MaskTester::get_stats() const
+{
+	Stats out{};
+	out.tested = tested;
+	out.failed = failed;
+	out.violations = violations;
+	return out;
+}
+
+void MaskTester::reset_stats()
+{
+	tested = 0;
+	failed = 0;
+	violations = 0;
+}
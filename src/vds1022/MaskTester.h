@@ -0,0 +1,58 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "Driver.h"
+
+// Pass / fail mask testing. Masks are compiled into the lowest and highest
+// ADC code allowed for each sample, so testing a frame is just two compares
+// per sample.
+//
+// Masks can be given as upper / lower limit tables, linearly interpolated
+// over the frame, or as forbidden polygons with vertices in (sample, ADC
+// code). A polygon restricts the upper limit if it's mostly over 0, and the
+// lower one otherwise, so regions in the middle of the screen (such as
+// the inside of an eye) can't be expressed and are refused.
+class MaskTester
+{
+public:
+	static const size_t NUM_SAMPLES = 5000;
+
+	MaskTester();
+
+	// Allows everything
+	void clear();
+	void set_upper(const std::vector<float>& table);
+	void set_lower(const std::vector<float>& table);
+	// Pairs of sample index and ADC code. false, with the mask left alone, if
+	// there are fewer than 3 or it reaches neither the top nor the bottom
+	bool add_polygon(const std::vector<float>& vertices);
+
+	// Returns the number of samples outside the mask
+	uint32_t test(const AcquiredData& data);
+	// Index of the first failing sample of the last test
+	uint32_t get_first_violation() const { return first_violation; }
+
+	struct Stats
+	{
+		uint64_t tested;
+		uint64_t failed;
+		uint64_t violations;
+	};
+	// Safe from any thread
+	Stats get_stats() const;
+	void reset_stats();
+
+protected:
+
+	std::array<int8_t, NUM_SAMPLES> upper;
+	std::array<int8_t, NUM_SAMPLES> lower;
+
+	uint32_t first_violation;
+
+	std::atomic<uint64_t> tested;
+	std::atomic<uint64_t> failed;
+	std::atomic<uint64_t> violations;
+};
@@ -0,0 +1,282 @@
+#include "MeasurementEngine.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Min, max, sum and sum of squares in a single pass
+static void reduce_samples(const int8_t* samples, size_t num_samples,
+	int32_t& out_min, int32_t& out_max, int64_t& out_sum, int64_t& out_sumsq)
+{
+	int32_t vmin = 127;
+	int32_t vmax = -128;
+	int64_t sum = 0;
+	int64_t sumsq = 0;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	// SSE2 has no signed byte min/max, so work on codes biased to unsigned.
+	// Sum of the biased codes comes from psadbw, squares from pmaddwd on
+	// the sign extended codes.
+	const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc_min = _mm_set1_epi8(static_cast<char>(0xFF));
+	__m128i acc_max = zero;
+	__m128i acc_sum = zero;
+	__m128i acc_sq = zero;
+
+	for(; i + 16 <= num_samples; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+		__m128i u = _mm_xor_si128(v, bias);
+		acc_min = _mm_min_epu8(acc_min, u);
+		acc_max = _mm_max_epu8(acc_max, u);
+		acc_sum = _mm_add_epi64(acc_sum, _mm_sad_epu8(u, zero));
+
+		__m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+		__m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+		__m128i sq = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+		// Each lane grows at most 65536 per iteration, widen to 64 bits right away
+		acc_sq = _mm_add_epi64(acc_sq, _mm_unpacklo_epi32(sq, zero));
+		acc_sq = _mm_add_epi64(acc_sq, _mm_unpackhi_epi32(sq, zero));
+	}
+
+	alignas(16) uint8_t mins[16];
+	alignas(16) uint8_t maxs[16];
+	alignas(16) int64_t sums[2];
+	alignas(16) int64_t sqs[2];
+	_mm_store_si128(reinterpret_cast<__m128i*>(mins), acc_min);
+	_mm_store_si128(reinterpret_cast<__m128i*>(maxs), acc_max);
+	_mm_store_si128(reinterpret_cast<__m128i*>(sums), acc_sum);
+	_mm_store_si128(reinterpret_cast<__m128i*>(sqs), acc_sq);
+
+	if(i > 0)
+	{
+		for(size_t j = 0; j < 16; j++)
+		{
+			vmin = std::min(vmin, static_cast<int32_t>(mins[j]) - 128);
+			vmax = std::max(vmax, static_cast<int32_t>(maxs[j]) - 128);
+		}
+		sum = sums[0] + sums[1] - 128 * static_cast<int64_t>(i);
+		sumsq = sqs[0] + sqs[1];
+	}
+#endif
+
+	for(; i < num_samples; i++)
+	{
+		int32_t v = samples[i];
+		vmin = std::min(vmin, v);
+		vmax = std::max(vmax, v);
+		sum += v;
+		sumsq += v * v;
+	}
+
+	out_min = vmin;
+	out_max = vmax;
+	out_sum = sum;
+	out_sumsq = sumsq;
+}
+
+MeasurementEngine::MeasurementEngine()
+:	last{}
+,	sequence(0)
+,	reset_pending(true)
+,	count(0)
+{
+	// std::atomic's default constructor leaves the value uninitialized
+	for(size_t m = 0; m < FrameMeasurements::NUM_MEASUREMENTS; m++)
+	{
+		stat_last[m].store(0.0, std::memory_order_relaxed);
+		stat_min[m].store(0.0, std::memory_order_relaxed);
+		stat_max[m].store(0.0, std::memory_order_relaxed);
+		stat_sum[m].store(0.0, std::memory_order_relaxed);
+	}
+}
+
+FrameMeasurements MeasurementEngine::measure(const int8_t* samples, size_t num_samples, double sample_rate)
+{
+	FrameMeasurements out{};
+	if(num_samples == 0)
+	{
+		return out;
+	}
+
+	int32_t vmin;
+	int32_t vmax;
+	int64_t sum;
+	int64_t sumsq;
+	reduce_samples(samples, num_samples, vmin, vmax, sum, sumsq);
+
+	float vpp = static_cast<float>(vmax - vmin);
+	out.values[FrameMeasurements::MIN] = static_cast<float>(vmin);
+	out.values[FrameMeasurements::MAX] = static_cast<float>(vmax);
+	out.values[FrameMeasurements::VPP] = vpp;
+	out.values[FrameMeasurements::MEAN] = static_cast<float>(static_cast<double>(sum) / num_samples);
+	out.values[FrameMeasurements::RMS] = static_cast<float>(std::sqrt(static_cast<double>(sumsq) / num_samples));
+
+	if(vpp < 1.0f)
+	{
+		return out;
+	}
+
+	// Edges, with the 10% and 90% levels acting as hysteresis. Crossing
+	// points are linearly interpolated between samples.
+	const float lo = vmin + 0.1f * vpp;
+	const float mid = vmin + 0.5f * vpp;
+	const float hi = vmin + 0.9f * vpp;
+
+	enum { UNKNOWN, LOW, HIGH } state = UNKNOWN;
+	float lo_cross = -1.0f;
+	float hi_cross = -1.0f;
+	double rise_sum = 0.0;
+	double fall_sum = 0.0;
+	uint32_t rises = 0;
+	uint32_t falls = 0;
+	uint32_t crossings = 0;
+
+	// Duty cycle is measured between the first and last rising edges on the mid level
+	int64_t first_mid_rise = -1;
+	int64_t last_mid_rise = -1;
+	size_t high_at_last_rise = 0;
+	size_t high_count = 0;
+
+	for(size_t i = 1; i < num_samples; i++)
+	{
+		float a = samples[i - 1];
+		float b = samples[i];
+
+		if(a < mid && b >= mid)
+		{
+			if(first_mid_rise < 0)
+			{
+				first_mid_rise = static_cast<int64_t>(i);
+				high_count = 0;
+			}
+			last_mid_rise = static_cast<int64_t>(i);
+			high_at_last_rise = high_count;
+		}
+		if(b >= mid)
+		{
+			high_count++;
+		}
+
+		if(a < lo && b >= lo)
+		{
+			lo_cross = (i - 1) + (lo - a) / (b - a);
+		}
+		else if(a > lo && b <= lo)
+		{
+			lo_cross = (i - 1) + (a - lo) / (a - b);
+			if(state == HIGH)
+			{
+				state = LOW;
+				crossings++;
+				if(hi_cross >= 0.0f)
+				{
+					fall_sum += lo_cross - hi_cross;
+					falls++;
+				}
+			}
+			else
+			{
+				state = LOW;
+			}
+		}
+
+		if(a < hi && b >= hi)
+		{
+			hi_cross = (i - 1) + (hi - a) / (b - a);
+			if(state == LOW)
+			{
+				state = HIGH;
+				crossings++;
+				if(lo_cross >= 0.0f)
+				{
+					rise_sum += hi_cross - lo_cross;
+					rises++;
+				}
+			}
+			else
+			{
+				state = HIGH;
+			}
+		}
+		else if(a > hi && b <= hi)
+		{
+			hi_cross = (i - 1) + (a - hi) / (a - b);
+		}
+	}
+
+	const double period = sample_rate > 0 ? 1.0 / sample_rate : 0.0;
+	out.values[FrameMeasurements::RISE] = rises > 0 ? static_cast<float>(rise_sum / rises * period) : 0.0f;
+	out.values[FrameMeasurements::FALL] = falls > 0 ? static_cast<float>(fall_sum / falls * period) : 0.0f;
+	out.values[FrameMeasurements::CROSSINGS] = static_cast<float>(crossings);
+
+	if(last_mid_rise > first_mid_rise)
+	{
+		out.values[FrameMeasurements::DUTY] =
+			static_cast<float>(high_at_last_rise) / static_cast<float>(last_mid_rise - first_mid_rise);
+	}
+	else
+	{
+		size_t total = 0;
+		for(size_t i = 0; i < num_samples; i++)
+		{
+			total += samples[i] >= mid ? 1 : 0;
+		}
+		out.values[FrameMeasurements::DUTY] = static_cast<float>(total) / num_samples;
+	}
+
+	return out;
+}
+
+const FrameMeasurements& MeasurementEngine::push_frame(const AcquiredData& data, double sample_rate)
+{
+	// Skip the 50 pre / post samples
+	last = measure(reinterpret_cast<const int8_t*>(data.samples.data() + 50), 5000, sample_rate);
+
+	// Odd sequence means an update is in progress, readers retry
+	sequence.fetch_add(1, std::memory_order_acq_rel);
+
+	bool reset = reset_pending.exchange(false);
+	uint64_t n = reset ? 0 : count.load(std::memory_order_relaxed);
+	for(size_t m = 0; m < FrameMeasurements::NUM_MEASUREMENTS; m++)
+	{
+		double v = last.values[m];
+		double vmin = n == 0 ? v : std::min(stat_min[m].load(std::memory_order_relaxed), v);
+		double vmax = n == 0 ? v : std::max(stat_max[m].load(std::memory_order_relaxed), v);
+		double vsum = (n == 0 ? 0.0 : stat_sum[m].load(std::memory_order_relaxed)) + v;
+
+		stat_last[m].store(v, std::memory_order_relaxed);
+		stat_min[m].store(vmin, std::memory_order_relaxed);
+		stat_max[m].store(vmax, std::memory_order_relaxed);
+		stat_sum[m].store(vsum, std::memory_order_relaxed);
+	}
+	count.store(n + 1, std::memory_order_relaxed);
+
+	sequence.fetch_add(1, std::memory_order_release);
+
+	return last;
+}
+
+MeasurementEngine::Stat MeasurementEngine::get_stat(FrameMeasurements::Measurement m) const
+{
+	Stat out{};
+	uint32_t seq;
+	do
+	{
+		seq = sequence.load(std::memory_order_acquire);
+		out.count = count.load(std::memory_order_relaxed);
+		out.last = stat_last[m].load(std::memory_order_relaxed);
+		out.min = stat_min[m].load(std::memory_order_relaxed);
+		out.max = stat_max[m].load(std::memory_order_relaxed);
+		out.mean = out.count > 0 ? stat_sum[m].load(std::memory_order_relaxed) / out.count : 0.0;
+		std::atomic_thread_fence(std::memory_order_acquire);
+	}
+	while((seq & 1) || seq != sequence.load(std::memory_order_relaxed));
+
+	return out;
+}
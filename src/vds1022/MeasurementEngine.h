@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "Driver.h"
+
+// Scalar measurements of a single frame. Amplitudes are in ADC codes and
+// times in seconds.
+struct FrameMeasurements
+{
+	enum Measurement
+	{
+		MIN,
+		MAX,
+		VPP,
+		MEAN,
+		RMS,
+		// 10% to 90%, averaged over all edges in the frame (0 if there's none)
+		RISE,
+		FALL,
+		// Fraction of time spent over 50%, over whole periods if there are any
+		DUTY,
+		// Number of transitions, with 10% / 90% as hysteresis
+		CROSSINGS,
+
+		NUM_MEASUREMENTS
+	};
+
+	float values[NUM_MEASUREMENTS];
+};
+
+// Measures every frame on the waveform thread and keeps running statistics
+// of each measurement. Statistics are written only by the waveform thread and
+// may be read from any thread without locking (sequence lock).
+class MeasurementEngine
+{
+public:
+	MeasurementEngine();
+
+	static FrameMeasurements measure(const int8_t* samples, size_t num_samples, double sample_rate);
+
+	const FrameMeasurements& push_frame(const AcquiredData& data, double sample_rate);
+
+	struct Stat
+	{
+		double last;
+		double min;
+		double max;
+		double mean;
+		uint64_t count;
+	};
+	Stat get_stat(FrameMeasurements::Measurement m) const;
+
+	// Safe from any thread, applied before the next frame is accumulated
+	void request_reset() { reset_pending = true; }
+
+protected:
+
+	FrameMeasurements last;
+
+	std::atomic<uint32_t> sequence;
+	std::atomic<bool> reset_pending;
+	std::atomic<uint64_t> count;
+	std::atomic<double> stat_last[FrameMeasurements::NUM_MEASUREMENTS];
+	std::atomic<double> stat_min[FrameMeasurements::NUM_MEASUREMENTS];
+	std::atomic<double> stat_max[FrameMeasurements::NUM_MEASUREMENTS];
+	std::atomic<double> stat_sum[FrameMeasurements::NUM_MEASUREMENTS];
+};
@@ -0,0 +1,107 @@
+#include "MinMaxPyramid.h"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// out[i] = op(in[2i], in[2i+1]), in has n entries, out gets (n + 1) / 2
+template<bool IS_MIN>
+static void reduce_pairs(const uint8_t* in, size_t n, uint8_t* out)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	// Split even and odd bytes into the low half of 16-bit lanes, reduce,
+	// and pack the 16-bit lanes back into bytes
+	const __m128i low_mask = _mm_set1_epi16(0x00FF);
+	for(; i + 32 <= n; i += 32)
+	{
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 16));
+		__m128i ra;
+		__m128i rb;
+		if(IS_MIN)
+		{
+			ra = _mm_min_epu8(_mm_and_si128(a, low_mask), _mm_srli_epi16(a, 8));
+			rb = _mm_min_epu8(_mm_and_si128(b, low_mask), _mm_srli_epi16(b, 8));
+		}
+		else
+		{
+			ra = _mm_max_epu8(_mm_and_si128(a, low_mask), _mm_srli_epi16(a, 8));
+			rb = _mm_max_epu8(_mm_and_si128(b, low_mask), _mm_srli_epi16(b, 8));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i / 2), _mm_packus_epi16(ra, rb));
+	}
+#endif
+
+	for(; i + 1 < n; i += 2)
+	{
+		out[i / 2] = IS_MIN ? std::min(in[i], in[i + 1]) : std::max(in[i], in[i + 1]);
+	}
+	if(i < n)
+	{
+		out[i / 2] = in[i];
+	}
+}
+
+MinMaxPyramid::MinMaxPyramid()
+{
+	// All levels are allocated once, down to a single column
+	for(size_t size = NUM_SAMPLES; ; size = (size + 1) / 2)
+	{
+		Level level;
+		level.size = size;
+		level.min.resize(size);
+		level.max.resize(size);
+		levels.push_back(level);
+
+		if(size == 1)
+		{
+			break;
+		}
+	}
+}
+
+void MinMaxPyramid::build(const AcquiredData& data)
+{
+	// Level 0 is the frame itself, skipping the 50 pre samples
+	const uint8_t* samples = data.samples.data() + 50;
+	Level& base = levels[0];
+	for(size_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		base.min[i] = samples[i] ^ 0x80;
+	}
+	base.max = base.min;
+
+	for(size_t k = 1; k < levels.size(); k++)
+	{
+		const Level& prev = levels[k - 1];
+		Level& cur = levels[k];
+		reduce_pairs<true>(prev.min.data(), prev.size, cur.min.data());
+		reduce_pairs<false>(prev.max.data(), prev.size, cur.max.data());
+	}
+}
+
+size_t MinMaxPyramid::pick_level(size_t max_columns) const
+{
+	for(size_t k = 0; k < levels.size(); k++)
+	{
+		if(levels[k].size <= max_columns)
+		{
+			return k;
+		}
+	}
+	return levels.size() - 1;
+}
+
+void MinMaxPyramid::get_envelope(size_t level, int8_t* out) const
+{
+	const Level& lvl = levels[level];
+	for(size_t i = 0; i < lvl.size; i++)
+	{
+		out[i * 2 + 0] = static_cast<int8_t>(lvl.min[i] ^ 0x80);
+		out[i * 2 + 1] = static_cast<int8_t>(lvl.max[i] ^ 0x80);
+	}
+}
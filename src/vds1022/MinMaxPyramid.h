@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Driver.h"
+
+// Min/max level of detail pyramid of a frame. Level k holds the min and max
+// of every block of 2^k samples, each level being built from the previous
+// one. Decimating to a display width is then just picking the finest level
+// that fits: short glitches always survive in the envelope, unlike with
+// plain decimation.
+class MinMaxPyramid
+{
+public:
+	static const size_t NUM_SAMPLES = 5000;
+
+	MinMaxPyramid();
+
+	void build(const AcquiredData& data);
+
+	// Finest level with at most max_columns columns (at least 1 column)
+	size_t pick_level(size_t max_columns) const;
+	size_t get_num_levels() const { return levels.size(); }
+	size_t get_columns(size_t level) const { return levels[level].size; }
+	size_t get_block_size(size_t level) const { return static_cast<size_t>(1) << level; }
+
+	// Writes get_columns(level) interleaved min, max pairs as signed ADC codes
+	void get_envelope(size_t level, int8_t* out) const;
+
+protected:
+
+	// Codes are kept flipped to unsigned, SSE2 only has unsigned byte min/max
+	struct Level
+	{
+		size_t size;
+		std::vector<uint8_t> min;
+		std::vector<uint8_t> max;
+	};
+	std::vector<Level> levels;
+};
@@ -0,0 +1,174 @@
+#pragma once
+#include <cstdint>
+
+// Everything sent through the waveform socket is packed and little endian.
+// Every packet starts with an OWONNetHeader so that clients can skip over
+// packet types they don't understand.
+
+enum OWONNetPacketType
+{
+	// Full acquisition of a channel (OWONVDS1022WaveformNetStruct)
+	NET_WAVEFORM = 0,
+	// Incremental samples while in roll mode (OWONVDS1022RollChunkNetStruct)
+	NET_ROLL_CHUNK = 1,
+	// Equivalent-time reconstruction of a channel (OWONVDS1022ETSNetStruct)
+	NET_ETS_WAVEFORM = 2,
+	// Scalar measurements of a frame (OWONVDS1022MeasurementsNetStruct)
+	NET_MEASUREMENTS = 3,
+	// Average of several frames (OWONVDS1022AveragedNetStruct)
+	NET_AVERAGED_WAVEFORM = 4,
+	// Persistence density map (OWONVDS1022PersistenceNetStruct)
+	NET_PERSISTENCE = 5,
+	// Min/max envelope of a frame (OWONVDS1022EnvelopeNetStruct)
+	NET_ENVELOPE = 6,
+	// Averaged power spectrum (OWONVDS1022SpectrumNetStruct)
+	NET_SPECTRUM = 7,
+	// Digital channel derived from an analog one (OWONVDS1022DigitalNetStruct)
+	NET_DIGITAL = 8,
+	// Mask test result of a frame (OWONVDS1022MaskResultNetStruct)
+	NET_MASK_RESULT = 9,
+	// Sin(x)/x interpolated part of a frame (OWONVDS1022InterpolatedNetStruct)
+	NET_INTERPOLATED = 10,
+	// Changes to the last waveform of a channel (OWONVDS1022DeltaNetStruct)
+	NET_DELTA_WAVEFORM = 11,
+};
+
+#pragma pack(push, 1)
+
+struct OWONNetHeader
+{
+	uint8_t type;
+	uint8_t ch;
+	// Bytes following this header which belong to the packet
+	uint32_t size;
+};
+
+struct OWONVDS1022WaveformNetStruct
+{
+	OWONNetHeader hdr;
+	uint32_t time_sum;
+	uint32_t period_num;
+	uint32_t cursor;
+	// Raw ADC codes, without the 50 pre / post samples
+	uint8_t samples[5000];
+};
+
+// Followed by num_samples raw ADC codes
+struct OWONVDS1022RollChunkNetStruct
+{
+	OWONNetHeader hdr;
+	// Index of the first sample of this chunk since roll mode started,
+	// a gap means samples were lost
+	uint64_t first_sample;
+	uint32_t sample_rate;
+	uint16_t num_samples;
+};
+
+// Followed by num_bins int16 values (in 1/256 of an ADC code) and then
+// num_bins uint8 counts of how many samples fell in each bin
+struct OWONVDS1022ETSNetStruct
+{
+	OWONNetHeader hdr;
+	// Effective sample rate is factor times the real one
+	uint32_t factor;
+	uint32_t num_bins;
+	uint32_t frames;
+	uint32_t filled_bins;
+};
+
+// Values indexed by FrameMeasurements::Measurement
+struct OWONVDS1022MeasurementsNetStruct
+{
+	OWONNetHeader hdr;
+	uint32_t num_values;
+	float values[9];
+};
+
+struct OWONVDS1022AveragedNetStruct
+{
+	OWONNetHeader hdr;
+	// Averager::Mode
+	uint8_t mode;
+	uint32_t frames;
+	// In 1/256 of an ADC code
+	int16_t samples[5000];
+};
+
+// Followed by rows x time_bins uint8 intensities, row by row starting
+// from the lowest ADC code
+struct OWONVDS1022PersistenceNetStruct
+{
+	OWONNetHeader hdr;
+	uint16_t rows;
+	uint16_t time_bins;
+	uint32_t frames;
+	// Hit count of cells at intensity 255
+	uint32_t peak;
+};
+
+// Followed by num_columns interleaved min, max pairs of signed ADC codes
+struct OWONVDS1022EnvelopeNetStruct
+{
+	OWONNetHeader hdr;
+	// Samples covered by each column (the last one may cover less)
+	uint32_t block_size;
+	uint32_t num_columns;
+};
+
+// Followed by num_bins float levels in dB, from DC up to half the sample rate
+struct OWONVDS1022SpectrumNetStruct
+{
+	OWONNetHeader hdr;
+	float bin_hz;
+	uint32_t num_bins;
+	uint32_t averages;
+	// SpectrumAnalyzer::Window
+	uint8_t window;
+};
+
+// ch is the index of the analog channel it's derived from. Followed by
+// (num_samples + 7) / 8 bytes of levels, 1 bit per sample LSB first, and then
+// num_edges uint16 indices of the samples where the level changes
+struct OWONVDS1022DigitalNetStruct
+{
+	OWONNetHeader hdr;
+	uint32_t num_samples;
+	uint32_t num_edges;
+};
+
+struct OWONVDS1022MaskResultNetStruct
+{
+	OWONNetHeader hdr;
+	// Samples of this frame outside the mask, 0 if it passed
+	uint32_t violations;
+	uint32_t first_violation;
+	// Running totals since the last reset
+	uint64_t tested;
+	uint64_t failed;
+};
+
+// Followed by num_points int16 values, in 1/256 of an ADC code. Point i is at
+// input sample first_sample + i / factor.
+struct OWONVDS1022InterpolatedNetStruct
+{
+	OWONNetHeader hdr;
+	uint32_t factor;
+	int32_t first_sample;
+	uint32_t num_points;
+};
+
+// Only sent in delta mode, where a NET_WAVEFORM is a keyframe the following
+// deltas of the channel apply to. Followed by num_runs runs, each a uint16
+// first sample and a uint16 length then that many raw ADC codes replacing
+// those of the waveform. Samples outside the runs are unchanged, or moved by
+// no more than the threshold set with DELTA:THRESHOLD.
+struct OWONVDS1022DeltaNetStruct
+{
+	OWONNetHeader hdr;
+	uint32_t time_sum;
+	uint32_t period_num;
+	uint32_t cursor;
+	uint32_t num_runs;
+};
+
+#pragma pack(pop)
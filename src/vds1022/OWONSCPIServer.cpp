@@ -1,221 +1,1988 @@
 #include "OWONSCPIServer.h"
 
 #include <log.h>
+#include <algorithm>
+#include <cstring>
 #include "NetStructs.h"
+#include "ScpiCommands.h"
 
-OWONSCPIServer::OWONSCPIServer(ZSOCKET sock, Socket&& wsock, Driver* dr)
+OWONSCPIServer::OWONSCPIServer(ZSOCKET sock, Socket&& wsock, VDS1022* sc)
 :	BridgeSCPIServer(sock)
 ,	waveform_socket(wsock)
-,	driver(dr)
+,	scope(sc)
+,	sample_rate(sc->get_sample_rate())
+,	peak_detect(false)
+,	roll_enabled(true)
+,	ets_enabled(false)
+,	measurements_only(false)
+,	averaging_enabled(false)
+,	persistence_enabled(false)
+,	persistence_interval(250)
+,	envelope_columns(0)
+,	spectrum_enabled(false)
+,	spectrum_rate{0, 0}
+,	interp_enabled(false)
+,	delta_enabled(false)
+,	mask_enabled(false)
+,	mask_send_failed(false)
+,	analog_range{10.0, 10.0}
+,	digital_enabled{false, false}
+,	digital_threshold{0.0, 0.0}
+,	digital_hysteresis{0.0, 0.0}
+,	last_preset{}
+,	flow_control(false)
+,	credits(0)
+,	wanted_in_flight(0)
+,	holding(false)
+,	frames_sent(0)
+,	frames_skipped(0)
 {
 	scpi_socket = sock;
 
-	waveform_quit = false;
-	waveform_thread = std::thread(&OWONSCPIServer::waveform_server, this);
+	configure_ets(10, 0, true);
+	configure_persistence(1000, false, 0);
+	configure_digital(0);
+	configure_digital(1);
+	configure_interpolation(4, 16, 250);
+
+	// Every stage starts from a clean state with the first frame
+	for(auto& generations : stage_generation)
+	{
+		generations[0] = generations[1] = scope->get_generation() - 1;
+	}
+
+	// Indices are the same as in Stage, as they are added in that order
+	pipeline.add_stage("filter", [this](PipelineFrame& f, uint8_t c) { run_filter(f, c); }, {}, true);
+	pipeline.add_stage("freq", [this](PipelineFrame& f, uint8_t c) { run_freq(f, c); }, {}, true);
+	pipeline.add_stage("measure", [this](PipelineFrame& f, uint8_t c) { run_measure(f, c); }, {STAGE_FILTER}, true);
+	pipeline.add_stage("output", [this](PipelineFrame& f, uint8_t c) { run_output(f, c); }, {STAGE_MEASURE}, true);
+	pipeline.add_stage("digital", [this](PipelineFrame& f, uint8_t c) { run_digital(f, c); }, {STAGE_FILTER}, true);
+	pipeline.set_deliver([this](PipelineFrame& f) { send_frame(f); });
+	pipeline.set_admit([this](PipelineFrame& f) { return admit_frame(f); });
+
+	// Enough for a waveform and its mask result, other modes grow it with their first frames
+	size_t output_size = sizeof(OWONVDS1022MaskResultNetStruct) + sizeof(OWONVDS1022WaveformNetStruct);
+	pipeline.reserve_packets(STAGE_OUTPUT, output_size);
+	held.packets[STAGE_OUTPUT][0].reserve(output_size);
+	held.packets[STAGE_OUTPUT][1].reserve(output_size);
+
+	scope->start(pipeline);
 }
 
 OWONSCPIServer::~OWONSCPIServer()
 {
-	waveform_quit = true;;
-	waveform_thread.join();
+	// Nothing may run on the pipeline once the server is gone
+	scope->stop();
+}
+
+bool OWONSCPIServer::new_generation(Stage stage, const PipelineFrame& frame, uint8_t ch)
+{
+	// Only touched by the stage itself, which sees one frame at a time
+	if(stage_generation[stage][ch] == frame.generation)
+	{
+		return false;
+	}
+	stage_generation[stage][ch] = frame.generation;
+	return true;
+}
+
+void OWONSCPIServer::run_filter(PipelineFrame& frame, uint8_t ch)
+{
+	frame.roll_samples[ch] = 0;
+	if(!frame.has_ch[ch])
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(stage_mtx[STAGE_FILTER][ch]);
+	if(new_generation(STAGE_FILTER, frame, ch))
+	{
+		roll_streams[ch].reset(ch, static_cast<uint32_t>(frame.sample_rate));
+		// Filters are designed for a given sample rate
+		filters[ch].configure(filters[ch].get_type(), filters[ch].get_freq(), filters[ch].get_param(),
+			static_cast<double>(frame.sample_rate));
+	}
+
+	// Chunks carry on from the previous frame, so they are built (and filtered) right here
+	if(frame.roll)
+	{
+		encode_roll_chunk(frame.packets[STAGE_FILTER][ch], ch, frame.data[ch], frame.roll_samples[ch]);
+		return;
+	}
+
+	// Frames aren't contiguous in block mode, each one is filtered on its own
+	filters[ch].process_block(frame.data[ch].samples.data(), frame.data[ch].samples.size());
+}
+
+void OWONSCPIServer::run_freq(PipelineFrame& frame, uint8_t ch)
+{
+	if(!frame.has_ch[ch])
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(stage_mtx[STAGE_FREQ][ch]);
+	if(new_generation(STAGE_FREQ, frame, ch))
+	{
+		freq_counters[ch].reset();
+	}
+	freq_counters[ch].push_frame(frame.data[ch]);
+}
+
+void OWONSCPIServer::run_measure(PipelineFrame& frame, uint8_t ch)
+{
+	if(!frame.has_ch[ch])
+	{
+		return;
+	}
+
+	// The engine is safe to use from other threads, nothing to lock
+	if(new_generation(STAGE_MEASURE, frame, ch))
+	{
+		measurements[ch].request_reset();
+	}
+	if(!frame.roll)
+	{
+		frame.measurements[ch] = measurements[ch].push_frame(frame.data[ch], static_cast<double>(frame.sample_rate));
+	}
+}
+
+void OWONSCPIServer::run_output(PipelineFrame& frame, uint8_t ch)
+{
+	if(!frame.has_ch[ch])
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(stage_mtx[STAGE_OUTPUT][ch]);
+	if(new_generation(STAGE_OUTPUT, frame, ch))
+	{
+		ets[ch].reset();
+		averagers[ch].reset();
+		persistence[ch].reset();
+		spectrum[ch].reset();
+		// The last waveform sent may not even have the same scale
+		deltas[ch].reset();
+	}
+	if(frame.roll)
+	{
+		return;
+	}
+
+	// Encoded later if the client asks for it before a newer frame comes
+	if(!frame.wanted && !output_keeps_state())
+	{
+		return;
+	}
+	encode_output(frame, ch);
+	if(!frame.wanted)
+	{
+		// Only held, and dropped if a newer frame comes first, so nothing may
+		// be a delta on it
+		deltas[ch].reset();
+	}
+}
+
+bool OWONSCPIServer::output_keeps_state()
+{
+	return !measurements_only && (mask_enabled || spectrum_enabled || ets_enabled || averaging_enabled || persistence_enabled);
+}
+
+void OWONSCPIServer::encode_output(PipelineFrame& frame, uint8_t ch)
+{
+	std::vector<uint8_t>& out = frame.packets[STAGE_OUTPUT][ch];
+	const AcquiredData& data = frame.data[ch];
+	if(measurements_only)
+	{
+		encode_measurements(out, ch, frame.measurements[ch]);
+	}
+	else if(mask_enabled)
+	{
+		encode_mask_result(out, ch, data);
+	}
+	else if(spectrum_enabled)
+	{
+		encode_spectrum(out, ch, data, frame.sample_rate);
+	}
+	else if(ets_enabled)
+	{
+		encode_ets(out, ch, data);
+	}
+	else if(averaging_enabled)
+	{
+		encode_averaged(out, ch, data);
+	}
+	else if(persistence_enabled)
+	{
+		encode_persistence(out, ch, data);
+	}
+	else if(interp_enabled)
+	{
+		encode_interpolated(out, ch, data);
+	}
+	else if(envelope_columns > 0)
+	{
+		encode_envelope(out, ch, data);
+	}
+	else
+	{
+		encode_waveform(out, ch, data);
+	}
+}
+
+void OWONSCPIServer::run_digital(PipelineFrame& frame, uint8_t ch)
+{
+	if(!frame.has_ch[ch] || frame.roll)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(stage_mtx[STAGE_DIGITAL][ch]);
+	if(new_generation(STAGE_DIGITAL, frame, ch))
+	{
+		// Replays come with the ranges they were recorded with
+		analog_range[ch] = Driver::RANGE_VOLTS_DIV[frame.ranges[ch]] * Driver::NUM_DIVISIONS;
+		update_digital_thresholds(ch);
+	}
+	encode_digital(frame.packets[STAGE_DIGITAL][ch], ch, frame.data[ch]);
 }
 
-void OWONSCPIServer::waveform_server()
+void OWONSCPIServer::send_frame(PipelineFrame& frame)
 {
-	// The device is slow enough that we can just keep a single buffer
-	AcquiredData ch1, ch2;
-	while(!waveform_quit)
+	AcquisitionTimes::Clock::time_point sent{};
 	{
-		// TODO: Add readyness / trigger check
-		Driver::DataReadResult result{};
+		std::lock_guard<std::mutex> lock(flow_mtx);
+		if(!frame.wanted)
 		{
-			std::unique_lock<std::mutex>(device_mtx);
-			result = driver->get_data(ch1, ch2, 10);
+			frames_skipped++;
+			hold_frame(frame);
 		}
-
-		if(result.kind == Driver::DataReadResult::OKAY)
+		else
 		{
-			OWONVDS1022WaveformNetStruct wfm;
-			if(result.has_ch1)
+			if(!frame.roll)
 			{
-				wfm.ch = 0;
-
-				waveform_socket.SendLooped(reinterpret_cast<uint8_t*>(&wfm), sizeof(OWONVDS1022WaveformNetStruct));
+				wanted_in_flight--;
 			}
 
-			if(result.has_ch2)
+			// Whatever was held is older than this
+			holding = false;
+			if(send_packets(frame))
+			{
+				sent = AcquisitionTimes::Clock::now();
+				frame_latency.add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					sent - frame.read_time).count()));
+			}
+			// Nothing to show for it, e.g. averaging still in progress
+			else if(flow_control && !frame.roll)
 			{
-				wfm.ch = 1;
+				credits++;
+			}
+		}
+	}
+
+	if(!frame.roll)
+	{
+		DeadTimeAnalyzer::Config config{};
+		config.sample_rate = frame.sample_rate;
+		config.channels = static_cast<uint8_t>((frame.has_ch[0] ? 1 : 0) | (frame.has_ch[1] ? 2 : 0));
+		config.peak_detect = peak_detect;
+		dead_time.add_frame(config, frame.generation, frame.times, sent);
+	}
+
+	pipeline.release(&frame);
+}
 
-				waveform_socket.SendLooped(reinterpret_cast<uint8_t*>(&wfm), sizeof(OWONVDS1022WaveformNetStruct));
+bool OWONSCPIServer::send_packets(const PipelineFrame& frame)
+{
+	bool sent = false;
+	for(uint8_t ch = 0; ch < 2; ch++)
+	{
+		for(size_t stage = 0; stage < NUM_STAGES; stage++)
+		{
+			const std::vector<uint8_t>& packets = frame.packets[stage][ch];
+			if(!packets.empty())
+			{
+				waveform_socket.SendLooped(packets.data(), static_cast<int>(packets.size()));
+				sent = true;
 			}
 		}
-		else if(result.kind != Driver::DataReadResult::TIMEOUT)
+
+		// Chunks go out as soon as they are read, the device is the one buffering
+		if(frame.roll_samples[ch] > 0)
 		{
-			// Sleep a bit to prevent continuous mutex locking
-			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			roll_streams[ch].on_sent(frame.read_time, frame.roll_samples[ch]);
 		}
 	}
+
+	if(sent && !frame.roll)
+	{
+		frames_sent++;
+	}
+	return sent;
 }
 
-std::string OWONSCPIServer::GetMake()
+bool OWONSCPIServer::admit_frame(const PipelineFrame& frame)
 {
-	return "OWON";
+	// Roll chunks are a stream, one missing would be a gap
+	if(frame.roll)
+	{
+		return true;
+	}
+
+	if(flow_control)
+	{
+		uint64_t available = credits;
+		do
+		{
+			if(available == 0)
+			{
+				return false;
+			}
+		} while(!credits.compare_exchange_weak(available, available - 1));
+	}
+	wanted_in_flight++;
+	return true;
 }
 
-std::string OWONSCPIServer::GetModel()
+void OWONSCPIServer::hold_frame(const PipelineFrame& frame)
 {
-	return "VDS1022";
+	// Copied, so that the pipeline doesn't run short of frames and can be flushed
+	if(!flow_control)
+	{
+		return;
+	}
+	// An averaged, persistence or spectrum result beats a frame that is still
+	// being accumulated
+	bool frame_output = !frame.packets[STAGE_OUTPUT][0].empty() || !frame.packets[STAGE_OUTPUT][1].empty();
+	bool held_output = !held.packets[STAGE_OUTPUT][0].empty() || !held.packets[STAGE_OUTPUT][1].empty();
+	if(holding && held_output && !frame_output)
+	{
+		return;
+	}
+	held.data[0] = frame.data[0];
+	held.data[1] = frame.data[1];
+	held.has_ch[0] = frame.has_ch[0];
+	held.has_ch[1] = frame.has_ch[1];
+	held.roll = false;
+	held.generation = frame.generation;
+	held.sample_rate = frame.sample_rate;
+	held.read_time = frame.read_time;
+	for(uint8_t ch = 0; ch < 2; ch++)
+	{
+		held.measurements[ch] = frame.measurements[ch];
+		held.roll_samples[ch] = 0;
+		for(size_t stage = 0; stage < NUM_STAGES; stage++)
+		{
+			held.packets[stage][ch] = frame.packets[stage][ch];
+		}
+	}
+	holding = true;
 }
 
-std::string OWONSCPIServer::GetSerial()
+void OWONSCPIServer::grant_credits(uint64_t count)
 {
-	return "placeholder";
+	std::lock_guard<std::mutex> lock(flow_mtx);
+	if(holding && count > 0 && wanted_in_flight == 0)
+	{
+		holding = false;
+
+		// Until credits are added nothing newer can be admitted, so the held
+		// frame is encoded in order with what was sent before
+		bool stale = false;
+		if(!output_keeps_state())
+		{
+			StageLock stage_lock(stage_mtx[STAGE_OUTPUT]);
+			for(uint8_t ch = 0; ch < 2; ch++)
+			{
+				// Taken with settings the output stage has moved on from
+				stale |= held.has_ch[ch] && stage_generation[STAGE_OUTPUT][ch] != held.generation;
+			}
+			for(uint8_t ch = 0; ch < 2 && !stale; ch++)
+			{
+				if(held.has_ch[ch])
+				{
+					held.packets[STAGE_OUTPUT][ch].clear();
+					encode_output(held, ch);
+				}
+			}
+		}
+
+		if(!stale && send_packets(held))
+		{
+			count--;
+		}
+	}
+	credits += count;
 }
 
-std::string OWONSCPIServer::GetFirmwareVersion()
+// Grows out by a packet of size bytes, returning where it goes
+static uint8_t* append_packet(std::vector<uint8_t>& out, size_t size)
 {
-	return "placeholder";
+	size_t offset = out.size();
+	out.resize(offset + size);
+	return out.data() + offset;
 }
 
-size_t OWONSCPIServer::GetAnalogChannelCount()
+void OWONSCPIServer::encode_waveform(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data)
 {
-	return 2;
+	// Skip the 50 pre samples
+	const uint8_t* samples = data.samples.data() + 50;
+	if(delta_enabled && !deltas[ch].encode(samples))
+	{
+		encode_delta(out, ch, data);
+		return;
+	}
+
+	OWONVDS1022WaveformNetStruct& wfm = *reinterpret_cast<OWONVDS1022WaveformNetStruct*>(
+		append_packet(out, sizeof(OWONVDS1022WaveformNetStruct)));
+	wfm.hdr.type = NET_WAVEFORM;
+	wfm.hdr.ch = ch;
+	wfm.hdr.size = sizeof(OWONVDS1022WaveformNetStruct) - sizeof(OWONNetHeader);
+	wfm.time_sum = data.time_sum;
+	wfm.period_num = data.period_num;
+	wfm.cursor = data.cursor;
+	std::memcpy(wfm.samples, samples, sizeof(wfm.samples));
 }
 
-std::vector<size_t> OWONSCPIServer::GetSampleRates()
+void OWONSCPIServer::encode_delta(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data)
 {
-	// TODO: There may be a way to obtain it from device
-	std::vector<size_t> ret;
-	ret.push_back(25);
-	ret.push_back(50);
-	ret.push_back(125);
-	ret.push_back(250);
-	ret.push_back(500);
-	ret.push_back(1250);
-	ret.push_back(2500);
-	ret.push_back(5000);
-	ret.push_back(12500);
-	ret.push_back(25000);
-	ret.push_back(50000);
-	ret.push_back(125000);
-	ret.push_back(250000);
-	ret.push_back(1250000);
-	ret.push_back(2500000);
-	ret.push_back(5000000);
-	ret.push_back(12500000);
-	ret.push_back(25000000);
-	ret.push_back(50000000);
-	ret.push_back(100000000);
+	const std::vector<DeltaEncoder::Run>& runs = deltas[ch].get_runs();
+	size_t size = sizeof(OWONVDS1022DeltaNetStruct);
+	for(const auto& run : runs)
+	{
+		size += DeltaEncoder::RUN_HEADER_SIZE + run.length;
+	}
 
-	return ret;
+	uint8_t* p = append_packet(out, size);
+	OWONVDS1022DeltaNetStruct& pkt = *reinterpret_cast<OWONVDS1022DeltaNetStruct*>(p);
+	pkt.hdr.type = NET_DELTA_WAVEFORM;
+	pkt.hdr.ch = ch;
+	pkt.hdr.size = static_cast<uint32_t>(size - sizeof(OWONNetHeader));
+	pkt.time_sum = data.time_sum;
+	pkt.period_num = data.period_num;
+	pkt.cursor = data.cursor;
+	pkt.num_runs = static_cast<uint32_t>(runs.size());
+
+	p += sizeof(OWONVDS1022DeltaNetStruct);
+	const uint8_t* samples = data.samples.data() + 50;
+	for(const auto& run : runs)
+	{
+		std::memcpy(p, &run.start, sizeof(run.start));
+		std::memcpy(p + 2, &run.length, sizeof(run.length));
+		std::memcpy(p + DeltaEncoder::RUN_HEADER_SIZE, samples + run.start, run.length);
+		p += DeltaEncoder::RUN_HEADER_SIZE + run.length;
+	}
 }
 
-std::vector<size_t> OWONSCPIServer::GetSampleDepths()
+void OWONSCPIServer::encode_measurements(std::vector<uint8_t>& out, uint8_t ch, const FrameMeasurements& meas)
 {
-	std::vector<size_t> ret;
-	ret.push_back(5000);
+	OWONVDS1022MeasurementsNetStruct pkt{};
+	pkt.hdr.type = NET_MEASUREMENTS;
+	pkt.hdr.ch = ch;
+	pkt.hdr.size = sizeof(OWONVDS1022MeasurementsNetStruct) - sizeof(OWONNetHeader);
+	pkt.num_values = FrameMeasurements::NUM_MEASUREMENTS;
+	static_assert(sizeof(pkt.values) == sizeof(meas.values), "Measurement packet out of sync");
+	std::memcpy(pkt.values, meas.values, sizeof(pkt.values));
 
-	return ret;
+	std::memcpy(append_packet(out, sizeof(pkt)), &pkt, sizeof(pkt));
 }
 
-void OWONSCPIServer::AcquisitionStart(bool oneShot)
+bool OWONSCPIServer::encode_roll_chunk(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data,
+	uint16_t& num_samples)
 {
+	num_samples = 0;
+	RollStream& stream = roll_streams[ch];
+	size_t size = stream.push_frame(data);
+	if(size == 0)
+	{
+		return false;
+	}
+
+	// Filter state carries over from the previous chunk
+	filters[ch].process(stream.get_chunk_samples(), stream.get_chunk_size());
+
+	num_samples = static_cast<uint16_t>(stream.get_chunk_size());
+	std::memcpy(append_packet(out, size), stream.get_packet(), size);
+	return true;
 }
 
-void OWONSCPIServer::AcquisitionForceTrigger()
+bool OWONSCPIServer::encode_ets(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data)
 {
+	EquivalentTimeSampler& sampler = ets[ch];
+	if(!sampler.push_frame(data))
+	{
+		return false;
+	}
+
+	// Bins are updated on every frame, but there's no point on sending
+	// the reconstruction faster than a display can show it
+	auto now = std::chrono::steady_clock::now();
+	if(now - ets_last_sent[ch] < std::chrono::milliseconds(50))
+	{
+		return false;
+	}
+	ets_last_sent[ch] = now;
+
+	size_t num_bins = sampler.get_num_bins();
+	OWONVDS1022ETSNetStruct hdr{};
+	hdr.hdr.type = NET_ETS_WAVEFORM;
+	hdr.hdr.ch = ch;
+	hdr.hdr.size = static_cast<uint32_t>(sizeof(hdr) - sizeof(OWONNetHeader) + num_bins * 3);
+	hdr.factor = sampler.get_factor();
+	hdr.num_bins = static_cast<uint32_t>(num_bins);
+	hdr.frames = sampler.get_frames();
+	hdr.filled_bins = sampler.get_filled_bins();
+
+	uint8_t* ptr = append_packet(out, sizeof(hdr) + num_bins * 3);
+	std::memcpy(ptr, &hdr, sizeof(hdr));
+	sampler.reconstruct(reinterpret_cast<int16_t*>(ptr + sizeof(hdr)), ptr + sizeof(hdr) + num_bins * 2);
+	return true;
 }
 
-void OWONSCPIServer::AcquisitionStop()
+bool OWONSCPIServer::encode_averaged(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data)
 {
+	Averager& averager = averagers[ch];
+	if(!averager.push_frame(data))
+	{
+		return false;
+	}
+
+	// Exponential averaging has a result every frame, don't send it faster
+	// than anyone could look at it
+	if(averager.get_mode() == Averager::EXPONENTIAL)
+	{
+		auto now = std::chrono::steady_clock::now();
+		if(now - averaged_last_sent[ch] < std::chrono::milliseconds(50))
+		{
+			return false;
+		}
+		averaged_last_sent[ch] = now;
+	}
+
+	OWONVDS1022AveragedNetStruct& pkt = *reinterpret_cast<OWONVDS1022AveragedNetStruct*>(
+		append_packet(out, sizeof(OWONVDS1022AveragedNetStruct)));
+	pkt.hdr.type = NET_AVERAGED_WAVEFORM;
+	pkt.hdr.ch = ch;
+	pkt.hdr.size = sizeof(OWONVDS1022AveragedNetStruct) - sizeof(OWONNetHeader);
+	pkt.mode = static_cast<uint8_t>(averager.get_mode());
+	pkt.frames = averager.get_frames();
+	averager.get_result(pkt.samples);
+	return true;
 }
 
-bool OWONSCPIServer::IsTriggerArmed()
+bool OWONSCPIServer::encode_persistence(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data)
 {
-	return false;
+	PersistenceHistogram& hist = persistence[ch];
+	hist.push_frame(data);
+
+	auto now = std::chrono::steady_clock::now();
+	if(now - persistence_last_sent[ch] < persistence_interval)
+	{
+		return false;
+	}
+	persistence_last_sent[ch] = now;
+
+	size_t image_size = PersistenceHistogram::NUM_ROWS * hist.get_time_bins();
+	OWONVDS1022PersistenceNetStruct hdr{};
+	hdr.hdr.type = NET_PERSISTENCE;
+	hdr.hdr.ch = ch;
+	hdr.hdr.size = static_cast<uint32_t>(sizeof(hdr) - sizeof(OWONNetHeader) + image_size);
+	hdr.rows = PersistenceHistogram::NUM_ROWS;
+	hdr.time_bins = static_cast<uint16_t>(hist.get_time_bins());
+	hdr.frames = hist.get_frames();
+
+	uint8_t* ptr = append_packet(out, sizeof(hdr) + image_size);
+	hdr.peak = hist.render(ptr + sizeof(hdr));
+	std::memcpy(ptr, &hdr, sizeof(hdr));
+	return true;
 }
 
-void OWONSCPIServer::SetChannelEnabled(size_t chIndex, bool enabled)
+void OWONSCPIServer::configure_persistence(size_t time_bins, bool align, int8_t level)
 {
+	StageLock lock(stage_mtx[STAGE_OUTPUT]);
+	for(auto& hist : persistence)
+	{
+		hist.configure(time_bins, align, level);
+	}
 }
 
-void OWONSCPIServer::SetAnalogCoupling(size_t chIndex, const std::string& coupling)
+void OWONSCPIServer::encode_envelope(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data)
 {
+	MinMaxPyramid& pyramid = pyramids[ch];
+	pyramid.build(data);
+	size_t level = pyramid.pick_level(envelope_columns);
+	size_t columns = pyramid.get_columns(level);
+
+	OWONVDS1022EnvelopeNetStruct hdr{};
+	hdr.hdr.type = NET_ENVELOPE;
+	hdr.hdr.ch = ch;
+	hdr.hdr.size = static_cast<uint32_t>(sizeof(hdr) - sizeof(OWONNetHeader) + columns * 2);
+	hdr.block_size = static_cast<uint32_t>(pyramid.get_block_size(level));
+	hdr.num_columns = static_cast<uint32_t>(columns);
+
+	uint8_t* ptr = append_packet(out, sizeof(hdr) + columns * 2);
+	std::memcpy(ptr, &hdr, sizeof(hdr));
+	pyramid.get_envelope(level, reinterpret_cast<int8_t*>(ptr + sizeof(hdr)));
 }
 
-void OWONSCPIServer::SetAnalogRange(size_t chIndex, double range_V)
+bool OWONSCPIServer::encode_spectrum(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data, uint64_t rate)
 {
+	SpectrumAnalyzer& analyzer = spectrum[ch];
+	if(!analyzer.push_frame(data))
+	{
+		return false;
+	}
+	spectrum_rate[ch] = rate;
+
+	size_t num_bins = analyzer.get_num_bins();
+	OWONVDS1022SpectrumNetStruct hdr{};
+	hdr.hdr.type = NET_SPECTRUM;
+	hdr.hdr.ch = ch;
+	hdr.hdr.size = static_cast<uint32_t>(sizeof(hdr) - sizeof(OWONNetHeader) + num_bins * sizeof(float));
+	hdr.bin_hz = static_cast<float>(static_cast<double>(rate) / analyzer.get_fft_size());
+	hdr.num_bins = static_cast<uint32_t>(num_bins);
+	hdr.averages = analyzer.get_averages();
+	hdr.window = static_cast<uint8_t>(analyzer.get_window());
+
+	uint8_t* ptr = append_packet(out, sizeof(hdr) + num_bins * sizeof(float));
+	std::memcpy(ptr, &hdr, sizeof(hdr));
+	std::memcpy(ptr + sizeof(hdr), analyzer.get_spectrum(), num_bins * sizeof(float));
+	return true;
 }
 
-void OWONSCPIServer::SetAnalogOffset(size_t chIndex, double offset_V)
+void OWONSCPIServer::encode_mask_result(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data)
 {
+	OWONVDS1022MaskResultNetStruct pkt{};
+	MaskTester& mask = masks[ch];
+	pkt.violations = mask.test(data);
+	pkt.first_violation = mask.get_first_violation();
+	MaskTester::Stats stats = mask.get_stats();
+	pkt.tested = stats.tested;
+	pkt.failed = stats.failed;
+
+	pkt.hdr.type = NET_MASK_RESULT;
+	pkt.hdr.ch = ch;
+	pkt.hdr.size = sizeof(OWONVDS1022MaskResultNetStruct) - sizeof(OWONNetHeader);
+	std::memcpy(append_packet(out, sizeof(pkt)), &pkt, sizeof(pkt));
+
+	if(pkt.violations > 0 && mask_send_failed)
+	{
+		encode_waveform(out, ch, data);
+	}
 }
 
-void OWONSCPIServer::SetDigitalThreshold(size_t chIndex, double threshold_V)
+void OWONSCPIServer::encode_interpolated(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data)
 {
+	SincInterpolator& interp = interpolators[ch];
+	size_t points = interp.process(data);
+
+	OWONVDS1022InterpolatedNetStruct hdr{};
+	hdr.hdr.type = NET_INTERPOLATED;
+	hdr.hdr.ch = ch;
+	hdr.hdr.size = static_cast<uint32_t>(sizeof(hdr) - sizeof(OWONNetHeader) + points * sizeof(int16_t));
+	hdr.factor = interp.get_factor();
+	hdr.first_sample = interp.get_first();
+	hdr.num_points = static_cast<uint32_t>(points);
+
+	uint8_t* ptr = append_packet(out, sizeof(hdr) + points * sizeof(int16_t));
+	std::memcpy(ptr, &hdr, sizeof(hdr));
+	std::memcpy(ptr + sizeof(hdr), interp.get_output(), points * sizeof(int16_t));
 }
 
-void OWONSCPIServer::SetDigitalHysteresis(size_t chIndex, double hysteresis)
+void OWONSCPIServer::configure_interpolation(uint32_t factor, uint32_t taps, uint32_t span)
 {
+	StageLock lock(stage_mtx[STAGE_OUTPUT]);
+	for(auto& interp : interpolators)
+	{
+		interp.configure(factor, taps, span);
+	}
 }
 
-void OWONSCPIServer::SetSampleRate(uint64_t rate_hz)
+bool OWONSCPIServer::encode_digital(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data)
 {
+	if(!digital_enabled[ch])
+	{
+		return false;
+	}
+
+	DigitalChannel& dig = digital[ch];
+	dig.push_frame(data);
+
+	size_t num_edges = dig.get_num_edges();
+	size_t size = sizeof(OWONVDS1022DigitalNetStruct) + DigitalChannel::NUM_BYTES + num_edges * sizeof(uint16_t);
+
+	OWONVDS1022DigitalNetStruct hdr{};
+	hdr.hdr.type = NET_DIGITAL;
+	hdr.hdr.ch = ch;
+	hdr.hdr.size = static_cast<uint32_t>(size - sizeof(OWONNetHeader));
+	hdr.num_samples = DigitalChannel::NUM_SAMPLES;
+	hdr.num_edges = static_cast<uint32_t>(num_edges);
+
+	uint8_t* ptr = append_packet(out, size);
+	std::memcpy(ptr, &hdr, sizeof(hdr));
+	ptr += sizeof(hdr);
+	std::memcpy(ptr, dig.get_bits(), DigitalChannel::NUM_BYTES);
+	ptr += DigitalChannel::NUM_BYTES;
+	std::memcpy(ptr, dig.get_edges(), num_edges * sizeof(uint16_t));
+	return true;
 }
 
-void OWONSCPIServer::SetSampleDepth(uint64_t depth)
+void OWONSCPIServer::configure_digital(size_t ch)
 {
+	std::lock_guard<std::mutex> lock(stage_mtx[STAGE_DIGITAL][ch]);
+	update_digital_thresholds(ch);
 }
 
-void OWONSCPIServer::SetTriggerDelay(uint64_t delay_fs)
+void OWONSCPIServer::update_digital_thresholds(size_t ch)
 {
+	// Thresholds are given in V, the comparator works on ADC codes
+	double codes_per_volt = ADC_CODES_PER_RANGE / analog_range[ch];
+	digital[ch].configure(static_cast<float>(digital_threshold[ch] * codes_per_volt),
+		static_cast<float>(digital_hysteresis[ch] * codes_per_volt));
 }
 
-void OWONSCPIServer::SetTriggerSource(size_t chIndex)
+void OWONSCPIServer::configure_ets(uint32_t factor, int8_t level, bool rising)
 {
+	StageLock lock(stage_mtx[STAGE_OUTPUT]);
+	for(auto& sampler : ets)
+	{
+		sampler.configure(factor, level, rising);
+	}
 }
 
-void OWONSCPIServer::SetTriggerLevel(double level_V)
+bool OWONSCPIServer::push_sampling_config(uint64_t rate_hz)
 {
+	return scope->set_sampling(static_cast<int32_t>(rate_hz), peak_detect, roll_enabled);
 }
 
-void OWONSCPIServer::SetTriggerTypeEdge()
+std::string OWONSCPIServer::GetMake()
 {
+	return "OWON";
 }
 
-void OWONSCPIServer::SetEdgeTriggerEdge(const std::string& edge)
+std::string OWONSCPIServer::GetModel()
 {
+	return "VDS1022";
 }
 
-bool OWONSCPIServer::GetChannelID(const std::string& subject, size_t& id_out)
+std::string OWONSCPIServer::GetSerial()
 {
-	return false;
+	return "placeholder";
 }
 
-BridgeSCPIServer::ChannelType OWONSCPIServer::GetChannelType(size_t channel)
+std::string OWONSCPIServer::GetFirmwareVersion()
 {
-	return CH_ANALOG;
+	return "placeholder";
 }
 
-
-bool OWONSCPIServer::OnQuery(const std::string& line, const std::string& subject, const std::string& cmd)
+size_t OWONSCPIServer::GetAnalogChannelCount()
 {
-	if(BridgeSCPIServer::OnQuery(line, subject, cmd))
-	{
-		return true;
-	}
+	return 2;
+}
 
-	return false;
+std::vector<size_t> OWONSCPIServer::GetSampleRates()
+{
+	return std::vector<size_t>(Driver::SAMPLE_RATES, Driver::SAMPLE_RATES + Driver::NUM_SAMPLE_RATES);
 }
 
-bool OWONSCPIServer::OnCommand(const std::string& line, const std::string& subject, const std::string& cmd,
-                               const std::vector<std::string>& args)
+std::vector<size_t> OWONSCPIServer::GetSampleDepths()
 {
-	if(BridgeSCPIServer::OnCommand(line, subject, cmd, args))
+	std::vector<size_t> ret;
+	ret.push_back(5000);
+
+	return ret;
+}
+
+void OWONSCPIServer::AcquisitionStart(bool oneShot)
+{
+}
+
+void OWONSCPIServer::AcquisitionForceTrigger()
+{
+}
+
+void OWONSCPIServer::AcquisitionStop()
+{
+}
+
+bool OWONSCPIServer::IsTriggerArmed()
+{
+	return false;
+}
+
+void OWONSCPIServer::SetChannelEnabled(size_t chIndex, bool enabled)
+{
+	if(chIndex >= 2 && chIndex < 4)
+	{
+		std::lock_guard<std::mutex> lock(stage_mtx[STAGE_DIGITAL][chIndex - 2]);
+		digital_enabled[chIndex - 2] = enabled;
+	}
+}
+
+void OWONSCPIServer::SetAnalogCoupling(size_t chIndex, const std::string& coupling)
+{
+}
+
+void OWONSCPIServer::SetAnalogRange(size_t chIndex, double range_V)
+{
+	if(chIndex >= 2 || range_V <= 0)
+	{
+		return;
+	}
+
+	// The device only has the calibrated ranges, the next one up shows it all
+	size_t range = Driver::find_range(range_V / Driver::NUM_DIVISIONS);
+	if(!scope->set_range(static_cast<uint8_t>(chIndex), range))
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(stage_mtx[STAGE_DIGITAL][chIndex]);
+		analog_range[chIndex] = Driver::RANGE_VOLTS_DIV[range] * Driver::NUM_DIVISIONS;
+	}
+	configure_digital(chIndex);
+}
+
+void OWONSCPIServer::SetAnalogOffset(size_t chIndex, double offset_V)
+{
+}
+
+void OWONSCPIServer::SetDigitalThreshold(size_t chIndex, double threshold_V)
+{
+	if(chIndex < 2 || chIndex >= 4)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(stage_mtx[STAGE_DIGITAL][chIndex - 2]);
+		digital_threshold[chIndex - 2] = threshold_V;
+	}
+	configure_digital(chIndex - 2);
+}
+
+void OWONSCPIServer::SetDigitalHysteresis(size_t chIndex, double hysteresis)
+{
+	if(chIndex < 2 || chIndex >= 4)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(stage_mtx[STAGE_DIGITAL][chIndex - 2]);
+		digital_hysteresis[chIndex - 2] = hysteresis;
+	}
+	configure_digital(chIndex - 2);
+}
+
+void OWONSCPIServer::SetSampleRate(uint64_t rate_hz)
+{
+	// Fastest rate the timebase divider does exactly, without going over
+	int32_t rate = Driver::find_sample_rate(rate_hz);
+	uint64_t rate_set = static_cast<uint64_t>(rate > 0 ? rate : Driver::SAMPLE_RATES[0]);
+	if(push_sampling_config(rate_set))
+	{
+		sample_rate = rate_set;
+	}
+}
+
+void OWONSCPIServer::SetSampleDepth(uint64_t depth)
+{
+}
+
+void OWONSCPIServer::SetTriggerDelay(uint64_t delay_fs)
+{
+}
+
+void OWONSCPIServer::SetTriggerSource(size_t chIndex)
+{
+}
+
+void OWONSCPIServer::SetTriggerLevel(double level_V)
+{
+}
+
+void OWONSCPIServer::SetTriggerTypeEdge()
+{
+}
+
+void OWONSCPIServer::SetEdgeTriggerEdge(const std::string& edge)
+{
+}
+
+bool OWONSCPIServer::GetChannelID(const std::string& subject, size_t& id_out)
+{
+	if(subject == "C1")
+	{
+		id_out = 0;
+		return true;
+	}
+	else if(subject == "C2")
+	{
+		id_out = 1;
+		return true;
+	}
+	// Digital channels derived from C1 and C2
+	else if(subject == "D1")
 	{
+		id_out = 2;
+		return true;
+	}
+	else if(subject == "D2")
+	{
+		id_out = 3;
 		return true;
 	}
 
 	return false;
 }
+
+BridgeSCPIServer::ChannelType OWONSCPIServer::GetChannelType(size_t channel)
+{
+	return channel < 2 ? CH_ANALOG : CH_DIGITAL;
+}
+
+
+void OWONSCPIServer::query_measurement(size_t chan, FrameMeasurements::Measurement m)
+{
+	// last,min,max,mean,count with amplitudes in V and times in seconds. Stats
+	// start over with new settings, so they were all taken with the current range.
+	auto stat = measurements[chan].get_stat(m);
+	double scale = 1.0;
+	if(m <= FrameMeasurements::RMS)
+	{
+		scale = analog_range[chan] / ADC_CODES_PER_RANGE;
+	}
+	char tmp[160];
+	snprintf(tmp, sizeof(tmp), "%.9g,%.9g,%.9g,%.9g,%llu", stat.last * scale, stat.min * scale,
+		stat.max * scale, stat.mean * scale, static_cast<unsigned long long>(stat.count));
+	SendReply(tmp);
+}
+
+bool OWONSCPIServer::parse_placement(ThreadPlacement& placement, const std::vector<std::string>& args)
+{
+	if(args.empty() || args.size() > 3)
+	{
+		return false;
+	}
+	return placement.parse(args[0], args.size() > 1 ? args[1] : "", args.size() > 2 ? args[2] : "");
+}
+
+bool OWONSCPIServer::OnQuery(const std::string& line, const std::string& subject, const std::string& cmd)
+{
+	if(BridgeSCPIServer::OnQuery(line, subject, cmd))
+	{
+		return true;
+	}
+
+	size_t chan = 0;
+	ScpiCommand command = find_scpi_command(subject, cmd, chan);
+	switch(command)
+	{
+		case SCPI_CH_FREQ:
+		case SCPI_CH_PERIOD:
+		{
+			// Straight from the hardware counters, no waveform needed
+			double value;
+			{
+				std::lock_guard<std::mutex> lock(stage_mtx[STAGE_FREQ][chan]);
+				value = command == SCPI_CH_FREQ ? freq_counters[chan].get_frequency() : freq_counters[chan].get_period();
+			}
+			char tmp[64];
+			snprintf(tmp, sizeof(tmp), "%.9g", value);
+			SendReply(tmp);
+			return true;
+		}
+
+		case SCPI_CH_MIN:
+		case SCPI_CH_MAX:
+		case SCPI_CH_VPP:
+		case SCPI_CH_MEAN:
+		case SCPI_CH_RMS:
+		case SCPI_CH_RISE:
+		case SCPI_CH_FALL:
+		case SCPI_CH_DUTY:
+		case SCPI_CH_CROSSINGS:
+			query_measurement(chan, static_cast<FrameMeasurements::Measurement>(command - SCPI_CH_MIN));
+			return true;
+
+		case SCPI_AVG_MODE:
+		{
+			static const char* modes[] = {"OFF", "BLOCK", "EXP"};
+			std::lock_guard<std::mutex> lock(stage_mtx[STAGE_OUTPUT][0]);
+			SendReply(modes[averagers[0].get_mode()]);
+			return true;
+		}
+
+		case SCPI_AVG_COUNT:
+		{
+			std::lock_guard<std::mutex> lock(stage_mtx[STAGE_OUTPUT][0]);
+			SendReply(std::to_string(averagers[0].get_count()));
+			return true;
+		}
+
+		case SCPI_CH_PEAK:
+		{
+			// Frequency in Hz and level in dB of the strongest tone of the last spectrum
+			float level;
+			double freq;
+			{
+				std::lock_guard<std::mutex> lock(stage_mtx[STAGE_OUTPUT][chan]);
+				freq = spectrum[chan].get_peak(level) * static_cast<double>(spectrum_rate[chan]);
+			}
+			char tmp[64];
+			snprintf(tmp, sizeof(tmp), "%.9g,%.3f", freq, level);
+			SendReply(tmp);
+			return true;
+		}
+
+		case SCPI_CH_MASKSTATS:
+		{
+			// tested,passed,failed,violating samples
+			MaskTester::Stats stats = masks[chan].get_stats();
+			char tmp[128];
+			snprintf(tmp, sizeof(tmp), "%llu,%llu,%llu,%llu",
+				static_cast<unsigned long long>(stats.tested),
+				static_cast<unsigned long long>(stats.tested - stats.failed),
+				static_cast<unsigned long long>(stats.failed),
+				static_cast<unsigned long long>(stats.violations));
+			SendReply(tmp);
+			return true;
+		}
+
+		case SCPI_DECIM_POINTS:
+		{
+			SendReply(std::to_string(envelope_columns));
+			return true;
+		}
+
+		case SCPI_FREQ_WINDOW:
+		{
+			std::lock_guard<std::mutex> lock(stage_mtx[STAGE_FREQ][0]);
+			SendReply(std::to_string(freq_counters[0].get_window()));
+			return true;
+		}
+
+		case SCPI_ROLL:
+		{
+			SendReply(scope->is_roll_mode() ? "1" : "0");
+			return true;
+		}
+
+		case SCPI_ROLL_LATENCY:
+		{
+			// Worst case (oldest sample) latency from sampling to socket, in ms
+			char tmp[128];
+			RollStream::LatencyStats ch1 = roll_streams[0].get_latency();
+			RollStream::LatencyStats ch2 = roll_streams[1].get_latency();
+			snprintf(tmp, sizeof(tmp), "%f,%f,%f,%f,%f,%f",
+				ch1.last_ms, ch1.mean_ms, ch1.max_ms, ch2.last_ms, ch2.mean_ms, ch2.max_ms);
+			SendReply(tmp);
+			return true;
+		}
+
+		case SCPI_SCHED_LATENCY:
+		{
+			// Last, mean and max in us of the task dispatch latency of the pipeline
+			// workers, then of the frames from USB to socket
+			LatencyTracker::Stats dispatch = TaskPool::get().get_dispatch_latency().get();
+			LatencyTracker::Stats frames = frame_latency.get();
+			char tmp[192];
+			snprintf(tmp, sizeof(tmp), "%.1f,%.1f,%.1f,%.1f,%.1f,%.1f",
+				dispatch.last_us, dispatch.mean_us, dispatch.max_us, frames.last_us, frames.mean_us, frames.max_us);
+			SendReply(tmp);
+			return true;
+		}
+
+		case SCPI_AUTOSET:
+		{
+			// Returns once settled: acquisitions,settled (0/1),ch1 range,ch2 range (full scale V),
+			// sample rate,frequency. ERROR, with nothing changed, if no frame could be acquired
+			if(!scope->is_open() || scope->is_replay())
+			{
+				LogError("Autoset needs a live device\n");
+				SendReply("ERROR");
+				return true;
+			}
+			VDS1022::AutosetResult result = scope->autoset();
+			if(result.acquisitions == 0)
+			{
+				LogError("Autoset acquired no frame\n");
+				SendReply("ERROR");
+				return true;
+			}
+			for(uint8_t ch = 0; ch < 2; ch++)
+			{
+				{
+					std::lock_guard<std::mutex> lock(stage_mtx[STAGE_DIGITAL][ch]);
+					analog_range[ch] = Driver::RANGE_VOLTS_DIV[result.ranges[ch]] * Driver::NUM_DIVISIONS;
+				}
+				configure_digital(ch);
+			}
+			sample_rate = static_cast<uint64_t>(result.sample_rate);
+
+			char tmp[192];
+			snprintf(tmp, sizeof(tmp), "%u,%d,%f,%f,%d,%f", result.acquisitions, result.settled ? 1 : 0,
+				analog_range[0], analog_range[1], result.sample_rate, result.frequency);
+			SendReply(tmp);
+			return true;
+		}
+
+		case SCPI_REC_STATUS:
+		{
+			// recording (0/1),frames,bytes of the current or last recording
+			std::string path;
+			uint64_t frames;
+			uint64_t bytes;
+			scope->get_recording_stats(path, frames, bytes);
+			char tmp[128];
+			snprintf(tmp, sizeof(tmp), "%d,%llu,%llu", scope->is_recording() ? 1 : 0,
+				static_cast<unsigned long long>(frames), static_cast<unsigned long long>(bytes));
+			SendReply(tmp);
+			return true;
+		}
+
+		case SCPI_ETS_FILL:
+		{
+			// frames,rejected,filled bins,total bins for each channel
+			StageLock lock(stage_mtx[STAGE_OUTPUT]);
+			char tmp[128];
+			snprintf(tmp, sizeof(tmp), "%u,%u,%u,%zu,%u,%u,%u,%zu",
+				ets[0].get_frames(), ets[0].get_rejected(), ets[0].get_filled_bins(), ets[0].get_num_bins(),
+				ets[1].get_frames(), ets[1].get_rejected(), ets[1].get_filled_bins(), ets[1].get_num_bins());
+			SendReply(tmp);
+			return true;
+		}
+
+		case SCPI_DELTA:
+		{
+			SendReply(delta_enabled ? "1" : "0");
+			return true;
+		}
+
+		case SCPI_DELTA_THRESHOLD:
+		{
+			std::lock_guard<std::mutex> lock(stage_mtx[STAGE_OUTPUT][0]);
+			SendReply(std::to_string(deltas[0].get_threshold()));
+			return true;
+		}
+
+		case SCPI_DELTA_KEYFRAME:
+		{
+			std::lock_guard<std::mutex> lock(stage_mtx[STAGE_OUTPUT][0]);
+			SendReply(std::to_string(deltas[0].get_keyframe_interval()));
+			return true;
+		}
+
+		case SCPI_DELTA_STATS:
+		{
+			// keyframes,deltas,bytes sent,bytes as full waveforms for both channels together
+			uint64_t keyframes = 0;
+			uint64_t sent = 0;
+			uint64_t frames = 0;
+			uint64_t full = 0;
+			StageLock lock(stage_mtx[STAGE_OUTPUT]);
+			for(const auto& encoder : deltas)
+			{
+				keyframes += encoder.get_keyframes();
+				frames += encoder.get_deltas();
+				sent += encoder.get_encoded_bytes();
+				full += encoder.get_full_bytes();
+			}
+			char tmp[128];
+			snprintf(tmp, sizeof(tmp), "%llu,%llu,%llu,%llu",
+				static_cast<unsigned long long>(keyframes), static_cast<unsigned long long>(frames),
+				static_cast<unsigned long long>(sent), static_cast<unsigned long long>(full));
+			SendReply(tmp);
+			return true;
+		}
+
+		case SCPI_FLOW:
+		{
+			SendReply(flow_control ? "1" : "0");
+			return true;
+		}
+
+		case SCPI_FLOW_STATS:
+		{
+			// credits left,frames sent,frames acquired without credits (all but the newest dropped)
+			std::lock_guard<std::mutex> lock(flow_mtx);
+			char tmp[128];
+			snprintf(tmp, sizeof(tmp), "%llu,%llu,%llu", static_cast<unsigned long long>(credits.load()),
+				static_cast<unsigned long long>(frames_sent), static_cast<unsigned long long>(frames_skipped));
+			SendReply(tmp);
+			return true;
+		}
+
+		case SCPI_DEADTIME:
+		{
+			// One configuration per ';' separated row: sample rate,channels (bits),peak (0/1),frames,
+			// window us,cycle us,waveforms/s,dead fraction, then the mean us of arm>trigger,
+			// trigger>finished,finished>transferred,transferred>sent (0 if not seen)
+			DeadTimeAnalyzer::Stats stats[DeadTimeAnalyzer::MAX_CONFIGS];
+			size_t count = dead_time.get_stats(stats, DeadTimeAnalyzer::MAX_CONFIGS);
+			std::string reply;
+			for(size_t i = 0; i < count; i++)
+			{
+				const DeadTimeAnalyzer::Stats& s = stats[i];
+				char tmp[256];
+				snprintf(tmp, sizeof(tmp), "%s%llu,%u,%d,%llu,%.1f,%.1f,%.2f,%.4f,%.1f,%.1f,%.1f,%.1f",
+					i > 0 ? ";" : "", static_cast<unsigned long long>(s.config.sample_rate), s.config.channels,
+					s.config.peak_detect ? 1 : 0, static_cast<unsigned long long>(s.frames), s.window_us, s.cycle_us,
+					s.waveforms_per_s, s.dead_fraction, s.armed_to_triggered_us, s.triggered_to_finished_us,
+					s.finished_to_transferred_us, s.transferred_to_sent_us);
+				reply += tmp;
+			}
+			SendReply(reply);
+			return true;
+		}
+
+		case SCPI_DEADTIME_PROBE:
+		{
+			SendReply(scope->is_phase_probing() ? "1" : "0");
+			return true;
+		}
+
+		case SCPI_PRESET:
+		{
+			// Names of the stored presets, ',' separated
+			std::string reply;
+			for(const auto& name : scope->get_preset_names())
+			{
+				reply += (reply.empty() ? "" : ",") + name;
+			}
+			SendReply(reply);
+			return true;
+		}
+
+		case SCPI_PRESET_LATENCY:
+		{
+			// Last, mean and max in us of the switches, then of the last one: us waiting for the
+			// device, us of the batch, registers written,registers of the preset
+			LatencyTracker::Stats stats = preset_latency.get();
+			char tmp[192];
+			snprintf(tmp, sizeof(tmp), "%.1f,%.1f,%.1f,%.1f,%.1f,%zu,%zu", stats.last_us, stats.mean_us, stats.max_us,
+				last_preset.wait_ns * 1e-3, last_preset.push_ns * 1e-3, last_preset.written, last_preset.registers);
+			SendReply(tmp);
+			return true;
+		}
+
+		default:
+			return false;
+	}
+}
+
+bool OWONSCPIServer::OnCommand(const std::string& line, const std::string& subject, const std::string& cmd,
+                               const std::vector<std::string>& args)
+{
+	if(BridgeSCPIServer::OnCommand(line, subject, cmd, args))
+	{
+		return true;
+	}
+
+	size_t chan = 0;
+	ScpiCommand command = find_scpi_command(subject, cmd, chan);
+	switch(command)
+	{
+		case SCPI_ROLL:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			roll_enabled = scpi_parse_bool(args[0]);
+			push_sampling_config(sample_rate);
+			return true;
+		}
+
+		case SCPI_SCHED_ACQ:
+		case SCPI_SCHED_WORKERS:
+		case SCPI_SCHED_SCPI:
+		{
+			// <cpus>[,OTHER|FIFO|RR[,<priority>]], with cpus as 2, 0-3, 1+5 or ANY
+			ThreadPlacement placement;
+			if(!parse_placement(placement, args))
+			{
+				return false;
+			}
+
+			if(command == SCPI_SCHED_ACQ)
+			{
+				scope->place_acquisition(placement);
+			}
+			else if(command == SCPI_SCHED_WORKERS)
+			{
+				TaskPool::get().place_workers(placement);
+			}
+			else
+			{
+				// Commands are handled on the SCPI thread itself
+				placement.apply_current();
+			}
+			return true;
+		}
+
+		case SCPI_SCHED_MLOCK:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			ThreadPlacement::lock_memory(scpi_parse_bool(args[0]));
+			return true;
+		}
+
+		case SCPI_SCHED_RESET:
+		{
+			TaskPool::get().get_dispatch_latency().reset();
+			frame_latency.reset();
+			return true;
+		}
+
+		case SCPI_REC_START:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			// Raw frames as read from the device, for replaying with --replay
+			return scope->start_recording(args[0]);
+		}
+
+		case SCPI_REC_STOP:
+		{
+			scope->stop_recording();
+			return true;
+		}
+
+		case SCPI_FREQ_WINDOW:
+		{
+			uint64_t window;
+			if(args.size() != 1 || !scpi_parse_uint(args[0], window, 0, UINT32_MAX))
+			{
+				return false;
+			}
+
+			// Number of frames the frequency counters are averaged over
+			StageLock lock(stage_mtx[STAGE_FREQ]);
+			for(auto& counter : freq_counters)
+			{
+				counter.set_window(static_cast<size_t>(window));
+			}
+			return true;
+		}
+
+		case SCPI_AVG_MODE:
+		case SCPI_AVG_COUNT:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			StageLock lock(stage_mtx[STAGE_OUTPUT]);
+			Averager::Mode mode = averagers[0].get_mode();
+			uint32_t count = averagers[0].get_count();
+			uint64_t value;
+			if(command == SCPI_AVG_COUNT)
+			{
+				if(!scpi_parse_uint(args[0], value, 0, UINT32_MAX))
+				{
+					return false;
+				}
+				count = static_cast<uint32_t>(value);
+			}
+			else if(args[0] == "BLOCK")
+			{
+				mode = Averager::BLOCK;
+			}
+			else if(args[0] == "EXP")
+			{
+				mode = Averager::EXPONENTIAL;
+			}
+			else if(args[0] == "OFF")
+			{
+				mode = Averager::OFF;
+			}
+			else
+			{
+				return false;
+			}
+
+			for(auto& averager : averagers)
+			{
+				averager.configure(mode, count);
+			}
+			averaging_enabled = mode != Averager::OFF;
+			return true;
+		}
+
+		case SCPI_PERSIST:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			StageLock lock(stage_mtx[STAGE_OUTPUT]);
+			persistence_enabled = scpi_parse_bool(args[0]);
+			for(auto& hist : persistence)
+			{
+				hist.reset();
+			}
+			return true;
+		}
+
+		case SCPI_PERSIST_INTERVAL:
+		{
+			uint64_t interval;
+			if(args.size() != 1 || !scpi_parse_uint(args[0], interval, 0, UINT32_MAX))
+			{
+				return false;
+			}
+
+			// In ms, how often the density map is sent
+			StageLock lock(stage_mtx[STAGE_OUTPUT]);
+			persistence_interval = std::chrono::milliseconds(interval);
+			return true;
+		}
+
+		case SCPI_PERSIST_BINS:
+		case SCPI_PERSIST_ALIGN:
+		case SCPI_PERSIST_RESET:
+		{
+			size_t time_bins;
+			bool align;
+			int8_t level;
+			{
+				std::lock_guard<std::mutex> lock(stage_mtx[STAGE_OUTPUT][0]);
+				time_bins = persistence[0].get_time_bins();
+				align = persistence[0].is_aligned();
+				level = persistence[0].get_level();
+			}
+
+			uint64_t bins;
+			int64_t code;
+			if(command == SCPI_PERSIST_BINS && args.size() == 1)
+			{
+				if(!scpi_parse_uint(args[0], bins, 0, UINT32_MAX))
+				{
+					return false;
+				}
+				time_bins = static_cast<size_t>(bins);
+			}
+			// Either OFF or the ADC code of the rising edge to align on
+			else if(command == SCPI_PERSIST_ALIGN && args.size() == 1)
+			{
+				align = args[0] != "OFF";
+				if(align)
+				{
+					if(!scpi_parse_int(args[0], code, INT8_MIN, INT8_MAX))
+					{
+						return false;
+					}
+					level = static_cast<int8_t>(code);
+				}
+			}
+			else if(command != SCPI_PERSIST_RESET)
+			{
+				return false;
+			}
+
+			configure_persistence(time_bins, align, level);
+			return true;
+		}
+
+		case SCPI_CH_FILTER:
+		{
+			if(args.empty())
+			{
+				return false;
+			}
+
+			// NONE, LP, HP, NOTCH or FIRLP, then cutoff / center frequency in Hz,
+			// then Q for NOTCH or number of taps for FIRLP
+			ChannelFilter::Type type;
+			if(args[0] == "NONE")
+			{
+				type = ChannelFilter::NONE;
+			}
+			else if(args[0] == "LP")
+			{
+				type = ChannelFilter::LOWPASS;
+			}
+			else if(args[0] == "HP")
+			{
+				type = ChannelFilter::HIGHPASS;
+			}
+			else if(args[0] == "NOTCH")
+			{
+				type = ChannelFilter::NOTCH;
+			}
+			else if(args[0] == "FIRLP")
+			{
+				type = ChannelFilter::FIR_LOWPASS;
+			}
+			else
+			{
+				return false;
+			}
+
+			double freq = 0.0;
+			double param = type == ChannelFilter::NOTCH ? 10.0 : 63.0;
+			if((args.size() > 1 && !scpi_parse_double(args[1], freq)) || (args.size() > 2 && !scpi_parse_double(args[2], param)))
+			{
+				return false;
+			}
+
+			std::lock_guard<std::mutex> lock(stage_mtx[STAGE_FILTER][chan]);
+			filters[chan].configure(type, freq, param, static_cast<double>(sample_rate));
+			return true;
+		}
+
+		case SCPI_INTERP:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			interp_enabled = scpi_parse_bool(args[0]);
+			return true;
+		}
+
+		case SCPI_INTERP_FACTOR:
+		case SCPI_INTERP_TAPS:
+		case SCPI_INTERP_SPAN:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			uint32_t factor;
+			uint32_t taps;
+			uint32_t span;
+			{
+				std::lock_guard<std::mutex> lock(stage_mtx[STAGE_OUTPUT][0]);
+				factor = interpolators[0].get_factor();
+				taps = interpolators[0].get_taps();
+				span = interpolators[0].get_span();
+			}
+
+			uint64_t parsed;
+			if(!scpi_parse_uint(args[0], parsed, 0, UINT32_MAX))
+			{
+				return false;
+			}
+			uint32_t value = static_cast<uint32_t>(parsed);
+			if(command == SCPI_INTERP_FACTOR)
+			{
+				factor = value;
+			}
+			else if(command == SCPI_INTERP_TAPS)
+			{
+				taps = value;
+			}
+			// Input samples on each side of the trigger
+			else
+			{
+				span = value;
+			}
+
+			configure_interpolation(factor, taps, span);
+			return true;
+		}
+
+		case SCPI_MASK:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			mask_enabled = scpi_parse_bool(args[0]);
+			return true;
+		}
+
+		case SCPI_MASK_SENDFAIL:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			mask_send_failed = scpi_parse_bool(args[0]);
+			return true;
+		}
+
+		case SCPI_MASK_RESET:
+		{
+			for(auto& mask : masks)
+			{
+				mask.reset_stats();
+			}
+			return true;
+		}
+
+		case SCPI_CH_MASKUPPER:
+		case SCPI_CH_MASKLOWER:
+		case SCPI_CH_MASKPOLY:
+		case SCPI_CH_MASKCLEAR:
+		{
+			// Limits in ADC codes, polygons as sample index, ADC code pairs
+			std::vector<float> values;
+			values.reserve(args.size());
+			for(auto& arg : args)
+			{
+				double value;
+				if(!scpi_parse_double(arg, value))
+				{
+					return false;
+				}
+				values.push_back(static_cast<float>(value));
+			}
+
+			std::lock_guard<std::mutex> lock(stage_mtx[STAGE_OUTPUT][chan]);
+			MaskTester& mask = masks[chan];
+			if(command == SCPI_CH_MASKUPPER)
+			{
+				mask.set_upper(values);
+			}
+			else if(command == SCPI_CH_MASKLOWER)
+			{
+				mask.set_lower(values);
+			}
+			else if(command == SCPI_CH_MASKPOLY)
+			{
+				if(!mask.add_polygon(values))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				mask.clear();
+			}
+			mask.reset_stats();
+			return true;
+		}
+
+		case SCPI_FFT:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			StageLock lock(stage_mtx[STAGE_OUTPUT]);
+			spectrum_enabled = scpi_parse_bool(args[0]);
+			for(auto& analyzer : spectrum)
+			{
+				analyzer.reset();
+			}
+			return true;
+		}
+
+		case SCPI_FFT_WINDOW:
+		case SCPI_FFT_AVG:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			StageLock lock(stage_mtx[STAGE_OUTPUT]);
+			SpectrumAnalyzer::Window window = spectrum[0].get_window();
+			uint32_t averages = spectrum[0].get_averages();
+			uint64_t value;
+			if(command == SCPI_FFT_AVG)
+			{
+				if(!scpi_parse_uint(args[0], value, 0, UINT32_MAX))
+				{
+					return false;
+				}
+				averages = static_cast<uint32_t>(value);
+			}
+			else if(args[0] == "HANN")
+			{
+				window = SpectrumAnalyzer::HANN;
+			}
+			else if(args[0] == "BLACKMANHARRIS")
+			{
+				window = SpectrumAnalyzer::BLACKMAN_HARRIS;
+			}
+			else if(args[0] == "FLATTOP")
+			{
+				window = SpectrumAnalyzer::FLAT_TOP;
+			}
+			else if(args[0] == "RECT" || args[0] == "RECTANGULAR")
+			{
+				window = SpectrumAnalyzer::RECTANGULAR;
+			}
+			else
+			{
+				return false;
+			}
+
+			for(auto& analyzer : spectrum)
+			{
+				analyzer.configure(window, averages);
+			}
+			return true;
+		}
+
+		case SCPI_DECIM_POINTS:
+		{
+			uint64_t columns;
+			if(args.size() != 1 || !scpi_parse_uint(args[0], columns, 0, UINT32_MAX))
+			{
+				return false;
+			}
+
+			// Maximum min/max columns per frame, 0 for full waveforms
+			envelope_columns = static_cast<uint32_t>(columns);
+			return true;
+		}
+
+		case SCPI_MEAS_RESET:
+		{
+			for(auto& engine : measurements)
+			{
+				engine.request_reset();
+			}
+			return true;
+		}
+
+		case SCPI_MEAS_STREAM:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			measurements_only = scpi_parse_bool(args[0]);
+			return true;
+		}
+
+		case SCPI_ETS:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			StageLock lock(stage_mtx[STAGE_OUTPUT]);
+			ets_enabled = scpi_parse_bool(args[0]);
+			for(auto& sampler : ets)
+			{
+				sampler.reset();
+			}
+			return true;
+		}
+
+		case SCPI_ETS_FACTOR:
+		case SCPI_ETS_LEVEL:
+		case SCPI_ETS_EDGE:
+		case SCPI_ETS_RESET:
+		{
+			uint32_t factor;
+			int8_t level;
+			bool rising;
+			{
+				std::lock_guard<std::mutex> lock(stage_mtx[STAGE_OUTPUT][0]);
+				factor = ets[0].get_factor();
+				level = ets[0].get_level();
+				rising = ets[0].is_rising();
+			}
+
+			uint64_t value;
+			int64_t code;
+			if(command == SCPI_ETS_FACTOR && args.size() == 1)
+			{
+				if(!scpi_parse_uint(args[0], value, 0, UINT32_MAX))
+				{
+					return false;
+				}
+				factor = static_cast<uint32_t>(value);
+			}
+			// In ADC codes, as the trigger level is only known by the device
+			else if(command == SCPI_ETS_LEVEL && args.size() == 1)
+			{
+				if(!scpi_parse_int(args[0], code, INT8_MIN, INT8_MAX))
+				{
+					return false;
+				}
+				level = static_cast<int8_t>(code);
+			}
+			else if(command == SCPI_ETS_EDGE && args.size() == 1)
+			{
+				rising = args[0] != "FALLING";
+			}
+			else if(command != SCPI_ETS_RESET)
+			{
+				return false;
+			}
+
+			configure_ets(factor, level, rising);
+			return true;
+		}
+
+		case SCPI_DELTA:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			// Whatever the client had may be stale, so start over with keyframes
+			StageLock lock(stage_mtx[STAGE_OUTPUT]);
+			delta_enabled = scpi_parse_bool(args[0]);
+			for(auto& encoder : deltas)
+			{
+				encoder.reset();
+				encoder.reset_stats();
+			}
+			return true;
+		}
+
+		case SCPI_DELTA_THRESHOLD:
+		case SCPI_DELTA_KEYFRAME:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			StageLock lock(stage_mtx[STAGE_OUTPUT]);
+			// In ADC codes, 0 to only leave out samples which didn't change at all
+			uint8_t threshold = deltas[0].get_threshold();
+			// In frames, 1 for keyframes only
+			uint32_t interval = deltas[0].get_keyframe_interval();
+			uint64_t value;
+			if(!scpi_parse_uint(args[0], value, 0, UINT32_MAX))
+			{
+				return false;
+			}
+			if(command == SCPI_DELTA_THRESHOLD)
+			{
+				threshold = static_cast<uint8_t>(std::min<uint64_t>(value, 255));
+			}
+			else
+			{
+				interval = static_cast<uint32_t>(value);
+			}
+			for(auto& encoder : deltas)
+			{
+				encoder.configure(threshold, interval);
+			}
+			return true;
+		}
+
+		case SCPI_FLOW:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			// Starts without credits, the client grants what it can take
+			std::lock_guard<std::mutex> lock(flow_mtx);
+			flow_control = scpi_parse_bool(args[0]);
+			credits = 0;
+			holding = false;
+			frames_sent = 0;
+			frames_skipped = 0;
+			return true;
+		}
+
+		case SCPI_FLOW_GRANT:
+		{
+			uint64_t granted;
+			if(args.size() != 1 || !scpi_parse_uint(args[0], granted, 0, UINT64_MAX))
+			{
+				return false;
+			}
+
+			grant_credits(granted);
+			return true;
+		}
+
+		case SCPI_DEADTIME_PROBE:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			// Only the frames acquired from now on have the trigger and finished phases
+			scope->set_phase_probing(scpi_parse_bool(args[0]));
+			dead_time.reset();
+			return true;
+		}
+
+		case SCPI_DEADTIME_RESET:
+		{
+			dead_time.reset();
+			return true;
+		}
+
+		case SCPI_PRESET_STORE:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			// The setup as it is now, ranges, sampling and trigger
+			return scope->store_preset(args[0]);
+		}
+
+		case SCPI_PRESET_APPLY:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			VDS1022::PresetSwitch result;
+			if(!scope->apply_preset(args[0], result))
+			{
+				LogWarning("Unable to switch to preset %s\n", args[0].c_str());
+				return false;
+			}
+			preset_latency.add(result.wait_ns + result.push_ns);
+			last_preset = result;
+
+			// What the preset set up is what later settings build on
+			sample_rate = static_cast<uint64_t>(result.sample_rate);
+			peak_detect = result.peak_detect;
+			roll_enabled = result.roll;
+			for(uint8_t ch = 0; ch < 2; ch++)
+			{
+				{
+					std::lock_guard<std::mutex> lock(stage_mtx[STAGE_DIGITAL][ch]);
+					analog_range[ch] = Driver::RANGE_VOLTS_DIV[result.ranges[ch]] * Driver::NUM_DIVISIONS;
+				}
+				configure_digital(ch);
+			}
+			return true;
+		}
+
+		case SCPI_PRESET_DELETE:
+		{
+			if(args.size() != 1)
+			{
+				return false;
+			}
+
+			return scope->delete_preset(args[0]);
+		}
+
+		default:
+			return false;
+	}
+}
@@ -1,6 +1,25 @@
 #pragma once
 
 #include "Driver.h"
+#include "VDS1022.h"
+#include "NetStructs.h"
+#include "RollStream.h"
+#include "EquivalentTimeSampler.h"
+#include "FramePipeline.h"
+#include "Averager.h"
+#include "ChannelFilter.h"
+#include "DeadTimeAnalyzer.h"
+#include "DeltaEncoder.h"
+#include "DigitalChannel.h"
+#include "FrequencyCounter.h"
+#include "LatencyTracker.h"
+#include "MaskTester.h"
+#include "MeasurementEngine.h"
+#include "MinMaxPyramid.h"
+#include "PersistenceHistogram.h"
+#include "SincInterpolator.h"
+#include "SpectrumAnalyzer.h"
+#include "ThreadPlacement.h"
 #include "../../lib/scpi-server-tools/BridgeSCPIServer.h"
 #include <mutex>
 #include <atomic>
@@ -12,21 +31,174 @@ public:
 	ZSOCKET scpi_socket;
 	Socket waveform_socket;
 
-	OWONSCPIServer(ZSOCKET sock, Socket&& wsock, Driver* driver);
+	// Acquisition runs on a thread of the scope for as long as the server
+	// exists, so main thread can work on communication only (and SCPI
+	// commands themselves)
+	OWONSCPIServer(ZSOCKET sock, Socket&& wsock, VDS1022* scope);
 	~OWONSCPIServer() override;
 
-	std::mutex device_mtx;
-	std::thread waveform_thread;
+protected:
 
-	std::atomic<bool> waveform_quit;
+	VDS1022* scope;
 
-	// Acquires waveforms from the device, so main thread can work
-	// on communication only (and SCPI commands themselves)
-	void waveform_server();
+	std::atomic<uint64_t> sample_rate;
+	std::atomic<bool> peak_detect;
+	// Use roll mode when the sample rate is low enough
+	std::atomic<bool> roll_enabled;
 
-protected:
+	// Processing of each frame, see the constructor for the stages
+	enum Stage
+	{
+		// Filtering, and chunking in roll mode
+		STAGE_FILTER,
+		STAGE_FREQ,
+		STAGE_MEASURE,
+		// Averaging, ETS, FFT... whatever mode is active
+		STAGE_OUTPUT,
+		STAGE_DIGITAL,
+
+		NUM_STAGES
+	};
+
+	// Protects the settings of the objects used by each stage and channel.
+	// The pipeline already makes sure a stage sees the frames of a channel one
+	// at a time, so this is only contended by SCPI commands.
+	std::mutex stage_mtx[NUM_STAGES][2];
+
+	// Holds a stage for both channels, for settings shared by the two
+	struct StageLock
+	{
+		std::lock_guard<std::mutex> ch1;
+		std::lock_guard<std::mutex> ch2;
+
+		explicit StageLock(std::mutex (&mtx)[2]) : ch1(mtx[0]), ch2(mtx[1]) {}
+	};
+
+	// Generation of the settings (see VDS1022) last seen by each stage, so it
+	// knows it must drop any state built from older frames
+	uint32_t stage_generation[NUM_STAGES][2];
+
+	RollStream roll_streams[2];
+
+	// Applied to the samples before anything else
+	ChannelFilter filters[2];
+
+	std::atomic<bool> ets_enabled;
+	EquivalentTimeSampler ets[2];
+	std::chrono::steady_clock::time_point ets_last_sent[2];
+
+	FrequencyCounter freq_counters[2];
+
+	MeasurementEngine measurements[2];
+	// Send measurements instead of waveforms
+	std::atomic<bool> measurements_only;
+
+	std::atomic<bool> averaging_enabled;
+	Averager averagers[2];
+	std::chrono::steady_clock::time_point averaged_last_sent[2];
+
+	std::atomic<bool> persistence_enabled;
+	std::chrono::milliseconds persistence_interval;
+	PersistenceHistogram persistence[2];
+	std::chrono::steady_clock::time_point persistence_last_sent[2];
+
+	// Columns wanted by the client, 0 to send full waveforms
+	std::atomic<uint32_t> envelope_columns;
+	MinMaxPyramid pyramids[2];
+
+	std::atomic<bool> spectrum_enabled;
+	SpectrumAnalyzer spectrum[2];
+	// Sample rate of the frames behind the last spectrum, as bins are relative to it
+	uint64_t spectrum_rate[2];
+
+	std::atomic<bool> interp_enabled;
+	SincInterpolator interpolators[2];
+
+	// Send waveforms as changes to the previous one
+	std::atomic<bool> delta_enabled;
+	DeltaEncoder deltas[2];
+
+	std::atomic<bool> mask_enabled;
+	// Also send the waveforms that failed the mask test
+	std::atomic<bool> mask_send_failed;
+	MaskTester masks[2];
+
+	// Full scale, in V
+	double analog_range[2];
+
+	// Virtual digital channels (D1 and D2, channel indices 2 and 3), one per analog channel
+	bool digital_enabled[2];
+	double digital_threshold[2];
+	double digital_hysteresis[2];
+	DigitalChannel digital[2];
+
+	// From the end of the USB transfer to the frame being on the socket
+	LatencyTracker frame_latency;
+	DeadTimeAnalyzer dead_time;
+
+	// Preset switches, from the command to the device set up
+	LatencyTracker preset_latency;
+	VDS1022::PresetSwitch last_preset;
+
+	// Credit based flow control: the client grants frames, and only gets more
+	// than it asked for as roll chunks. Frames acquired without credits skip
+	// the output stage unless it keeps state, and only the newest of them is
+	// kept, to go out as soon as a credit comes.
+	std::atomic<bool> flow_control;
+	std::atomic<uint64_t> credits;
+	// Frames admitted with a credit (or without flow control) not delivered yet
+	std::atomic<uint32_t> wanted_in_flight;
+	// Held while writing to the waveform socket
+	std::mutex flow_mtx;
+	bool holding;
+	PipelineFrame held;
+	uint64_t frames_sent;
+	uint64_t frames_skipped;
+
+	// Declared last, so it is gone before anything its stages use
+	FramePipeline pipeline;
+
+	bool push_sampling_config(uint64_t rate_hz);
+
+	// Pipeline stages
+	bool new_generation(Stage stage, const PipelineFrame& frame, uint8_t ch);
+	void run_filter(PipelineFrame& frame, uint8_t ch);
+	void run_freq(PipelineFrame& frame, uint8_t ch);
+	void run_measure(PipelineFrame& frame, uint8_t ch);
+	void run_output(PipelineFrame& frame, uint8_t ch);
+	void run_digital(PipelineFrame& frame, uint8_t ch);
+	// Sends the packets of a frame, in stage order for each channel
+	void send_frame(PipelineFrame& frame);
+	bool send_packets(const PipelineFrame& frame);
+	bool admit_frame(const PipelineFrame& frame);
+	void hold_frame(const PipelineFrame& frame);
+	void grant_credits(uint64_t count);
+	// Whether the output stage builds on previous frames, and must see them all
+	bool output_keeps_state();
+	void encode_output(PipelineFrame& frame, uint8_t ch);
 
-	Driver* driver;
+	// Each of these appends a packet to out, returning false if there is nothing to send
+	// A keyframe or, in delta mode, the changes since the last waveform
+	void encode_waveform(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data);
+	void encode_delta(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data);
+	bool encode_roll_chunk(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data, uint16_t& num_samples);
+	bool encode_ets(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data);
+	void encode_measurements(std::vector<uint8_t>& out, uint8_t ch, const FrameMeasurements& meas);
+	bool encode_averaged(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data);
+	bool encode_persistence(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data);
+	void encode_envelope(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data);
+	bool encode_spectrum(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data, uint64_t rate);
+	bool encode_digital(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data);
+	void encode_mask_result(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data);
+	void encode_interpolated(std::vector<uint8_t>& out, uint8_t ch, const AcquiredData& data);
+	void configure_persistence(size_t time_bins, bool align, int8_t level);
+	void configure_interpolation(uint32_t factor, uint32_t taps, uint32_t span);
+	void configure_digital(size_t ch);
+	// With stage_mtx[STAGE_DIGITAL][ch] held
+	void update_digital_thresholds(size_t ch);
+	void configure_ets(uint32_t factor, int8_t level, bool rising);
+	void query_measurement(size_t chan, FrameMeasurements::Measurement m);
+	bool parse_placement(ThreadPlacement& placement, const std::vector<std::string>& args);
 
 
 	std::string GetMake() override;
@@ -0,0 +1,118 @@
+#include "PersistenceHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "EquivalentTimeSampler.h"
+
+// Samples of the ADC buffer actually shown, skipping the 50 pre / post samples
+static const size_t FIRST_SAMPLE = 50;
+static const size_t NUM_SAMPLES = 5000;
+
+PersistenceHistogram::PersistenceHistogram()
+:	time_bins(0)
+,	align(false)
+,	level(0)
+,	frames(0)
+{
+}
+
+void PersistenceHistogram::configure(size_t _time_bins, bool _align, int8_t _level)
+{
+	time_bins = _time_bins < 1 ? 1 : (_time_bins > MAX_TIME_BINS ? MAX_TIME_BINS : _time_bins);
+	align = _align;
+	level = _level;
+
+	column_of_sample.resize(NUM_SAMPLES);
+	for(size_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		column_of_sample[i] = static_cast<uint16_t>(i * time_bins / NUM_SAMPLES);
+	}
+
+	counts.assign(NUM_ROWS * time_bins, 0);
+	reset();
+}
+
+void PersistenceHistogram::reset()
+{
+	std::fill(counts.begin(), counts.end(), 0);
+	frames = 0;
+}
+
+void PersistenceHistogram::push_frame(const AcquiredData& data)
+{
+	if(counts.empty())
+	{
+		return;
+	}
+
+	const uint8_t* samples = data.samples.data() + FIRST_SAMPLE;
+	uint32_t* cells = counts.data();
+
+	if(!align)
+	{
+		// Codes are flipped to unsigned so row 0 is the most negative one.
+		// Samples are stored column by column, so consecutive samples going to
+		// the same column hit close cells.
+		const uint16_t* columns = column_of_sample.data();
+		for(size_t i = 0; i < NUM_SAMPLES; i++)
+		{
+			size_t row = samples[i] ^ 0x80;
+			cells[columns[i] * NUM_ROWS + row]++;
+		}
+		frames++;
+		return;
+	}
+
+	float phase = EquivalentTimeSampler::find_trigger_phase(data, level, true);
+	if(phase < 0.0f)
+	{
+		return;
+	}
+
+	// Move the trigger to the center of the time axis
+	float trigger = static_cast<float>(data.samples.size()) - static_cast<float>(data.cursor)
+		- FIRST_SAMPLE + (phase - std::floor(phase));
+	float offset = trigger - NUM_SAMPLES / 2.0f;
+	float scale = static_cast<float>(time_bins) / NUM_SAMPLES;
+
+	for(size_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		float col = (i - offset) * scale;
+		if(col < 0.0f || col >= time_bins)
+		{
+			continue;
+		}
+
+		size_t row = samples[i] ^ 0x80;
+		cells[static_cast<size_t>(col) * NUM_ROWS + row]++;
+	}
+	frames++;
+}
+
+uint32_t PersistenceHistogram::render(uint8_t* image) const
+{
+	uint32_t peak = 0;
+	for(uint32_t c : counts)
+	{
+		peak = std::max(peak, c);
+	}
+	if(peak == 0)
+	{
+		std::fill(image, image + NUM_ROWS * time_bins, 0);
+		return 0;
+	}
+
+	// Linear scale, but anything that was hit at least once stays visible
+	for(size_t col = 0; col < time_bins; col++)
+	{
+		for(size_t row = 0; row < NUM_ROWS; row++)
+		{
+			uint32_t c = counts[col * NUM_ROWS + row];
+			uint32_t v = static_cast<uint32_t>((static_cast<uint64_t>(c) * 255) / peak);
+			image[row * time_bins + col] = static_cast<uint8_t>(c > 0 && v == 0 ? 1 : v);
+		}
+	}
+
+	return peak;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Driver.h"
+
+// Infinite persistence / eye diagram accumulation. Each frame increments
+// one cell per sample of a 256 (ADC codes) x time_bins histogram, and the
+// result is only sent out as a scaled 8-bit image every now and then, so
+// the device can keep acquiring at full rate.
+//
+// Frames may optionally be aligned on their sub-sample trigger position
+// (see EquivalentTimeSampler) which keeps jitter out of the time axis.
+class PersistenceHistogram
+{
+public:
+	static const size_t NUM_ROWS = 256;
+	static const size_t MAX_TIME_BINS = 5000;
+
+	PersistenceHistogram();
+
+	// Also clears the histogram
+	void configure(size_t time_bins, bool align, int8_t level);
+	void reset();
+
+	size_t get_time_bins() const { return time_bins; }
+	bool is_aligned() const { return align; }
+	int8_t get_level() const { return level; }
+	uint32_t get_frames() const { return frames; }
+
+	void push_frame(const AcquiredData& data);
+
+	// Writes NUM_ROWS x time_bins bytes, row 0 being the lowest ADC code.
+	// Returns the count which was scaled to 255.
+	uint32_t render(uint8_t* image) const;
+
+protected:
+
+	size_t time_bins;
+	bool align;
+	int8_t level;
+	uint32_t frames;
+
+	// Time bin of each sample when not aligning, so the hot loop is a lookup
+	std::vector<uint16_t> column_of_sample;
+	std::vector<uint32_t> counts;
+};
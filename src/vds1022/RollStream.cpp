@@ -0,0 +1,101 @@
+#include "RollStream.h"
+
+#include <cstring>
+
+RollStream::RollStream()
+:	channel(0)
+,	sample_rate(1)
+,	last_cursor(0)
+,	sample_index(0)
+,	last_chunk_samples(0)
+,	packet{}
+,	latency_last_ns(0)
+,	latency_max_ns(0)
+,	latency_sum_ns(0)
+,	latency_count(0)
+{
+}
+
+void RollStream::reset(uint8_t ch, uint32_t rate_hz)
+{
+	channel = ch;
+	sample_rate = rate_hz > 0 ? rate_hz : 1;
+	last_cursor = 0;
+	sample_index = 0;
+	last_chunk_samples = 0;
+
+	latency_last_ns = 0;
+	latency_max_ns = 0;
+	latency_sum_ns = 0;
+	latency_count = 0;
+}
+
+size_t RollStream::push_frame(const AcquiredData& data)
+{
+	const uint32_t max_samples = static_cast<uint32_t>(data.samples.size());
+
+	// Cursor going back means the device started a new sweep. What it wrote
+	// after our last read of the previous one is gone, but still counted so
+	// that clients see the gap.
+	uint32_t cursor = data.cursor > max_samples ? max_samples : data.cursor;
+	uint32_t num_new = cursor;
+	if(cursor >= last_cursor)
+	{
+		num_new = cursor - last_cursor;
+	}
+	else
+	{
+		sample_index += max_samples - last_cursor;
+	}
+	last_cursor = cursor;
+
+	if(num_new == 0)
+	{
+		return 0;
+	}
+
+	OWONVDS1022RollChunkNetStruct hdr{};
+	hdr.hdr.type = NET_ROLL_CHUNK;
+	hdr.hdr.ch = channel;
+	hdr.hdr.size = sizeof(OWONVDS1022RollChunkNetStruct) - sizeof(OWONNetHeader) + num_new;
+	hdr.first_sample = sample_index;
+	hdr.sample_rate = sample_rate;
+	hdr.num_samples = static_cast<uint16_t>(num_new);
+
+	// Newest samples are the rightmost ones
+	std::memcpy(packet.data(), &hdr, sizeof(hdr));
+	std::memcpy(packet.data() + sizeof(hdr), data.samples.data() + max_samples - num_new, num_new);
+
+	sample_index += num_new;
+	last_chunk_samples = static_cast<uint16_t>(num_new);
+
+	return sizeof(hdr) + num_new;
+}
+
+void RollStream::on_sent(Clock::time_point read_time, size_t num_samples)
+{
+	// The oldest sample of the chunk was taken (roughly) num_samples periods
+	// before we read it out of the device
+	auto now = Clock::now();
+	uint64_t age_ns = static_cast<uint64_t>(num_samples) * 1000000000ULL / sample_rate;
+	uint64_t lat_ns = static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(now - read_time).count()) + age_ns;
+
+	latency_last_ns = lat_ns;
+	latency_sum_ns += lat_ns;
+	latency_count++;
+	if(lat_ns > latency_max_ns)
+	{
+		latency_max_ns = lat_ns;
+	}
+}
+
+RollStream::LatencyStats RollStream::get_latency() const
+{
+	LatencyStats out{};
+	out.chunks = latency_count;
+	out.last_ms = latency_last_ns * 1e-6;
+	out.max_ms = latency_max_ns * 1e-6;
+	out.mean_ms = out.chunks > 0 ? (latency_sum_ns * 1e-6) / out.chunks : 0.0;
+	return out;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include "Driver.h"
+#include "NetStructs.h"
+
+// Turns the frames read in roll mode into small chunks holding only the
+// samples that are new since the previous read. Memory use is fixed no
+// matter how long the session is: a chunk never holds more than one frame.
+//
+// In roll mode the device keeps shifting samples into its buffer from the right,
+// and cursor counts how many of them were written in the current sweep.
+class RollStream
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	RollStream();
+
+	// Starts a new stream, the sample index goes back to zero
+	void reset(uint8_t ch, uint32_t rate_hz);
+
+	// Builds a chunk with the new samples in data. Returns the size in bytes of
+	// the packet (0 if there was nothing new), which is valid until the next call
+	size_t push_frame(const AcquiredData& data);
+	const uint8_t* get_packet() const { return packet.data(); }
+	// Samples of the last chunk, which may be modified before sending it
+	uint8_t* get_chunk_samples() { return packet.data() + sizeof(OWONVDS1022RollChunkNetStruct); }
+	size_t get_chunk_size() const { return last_chunk_samples; }
+
+	// Call once a chunk of num_samples built from the frame read at read_time
+	// is on the socket. Chunks may be sent after the next one was built.
+	void on_sent(Clock::time_point read_time, size_t num_samples);
+
+	struct LatencyStats
+	{
+		double last_ms;
+		double mean_ms;
+		double max_ms;
+		uint64_t chunks;
+	};
+	// Safe to call from other threads
+	LatencyStats get_latency() const;
+	uint64_t get_sample_index() const { return sample_index; }
+
+protected:
+
+	uint8_t channel;
+	std::atomic<uint32_t> sample_rate;
+	uint32_t last_cursor;
+	std::atomic<uint64_t> sample_index;
+	uint16_t last_chunk_samples;
+
+	std::array<uint8_t, sizeof(OWONVDS1022RollChunkNetStruct) + 5100> packet;
+
+	std::atomic<uint64_t> latency_last_ns;
+	std::atomic<uint64_t> latency_max_ns;
+	std::atomic<uint64_t> latency_sum_ns;
+	std::atomic<uint64_t> latency_count;
+};
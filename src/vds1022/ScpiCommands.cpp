@@ -0,0 +1,133 @@
+#include "ScpiCommands.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// The case labels of find_scpi_command() are computed from this at compile time.
+// Unsized, so that the assert below catches a name too many or too few.
+constexpr ScpiCommandName SCPI_COMMAND_NAMES[] =
+{
+	{"", ""},
+#define SCPI_NAME_ENTRY(id, subject, cmd) {subject, cmd},
+	SCPI_COMMAND_LIST(SCPI_NAME_ENTRY)
+#undef SCPI_NAME_ENTRY
+};
+
+static_assert(sizeof(SCPI_COMMAND_NAMES) / sizeof(SCPI_COMMAND_NAMES[0]) == SCPI_NUM_COMMANDS, "Every ScpiCommand needs a name");
+
+static constexpr uint64_t key(ScpiCommand command)
+{
+	return scpi_hash(SCPI_COMMAND_NAMES[command].subject, SCPI_COMMAND_NAMES[command].cmd);
+}
+
+static uint64_t hash(const char* subject, size_t subject_len, const std::string& cmd)
+{
+	uint64_t h = 14695981039346656037ull;
+	for(size_t i = 0; i < subject_len; i++)
+	{
+		h = (h ^ static_cast<uint8_t>(subject[i])) * 1099511628211ull;
+	}
+	h = (h ^ ':') * 1099511628211ull;
+	for(char c : cmd)
+	{
+		h = (h ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+	}
+	return h;
+}
+
+ScpiCommand find_scpi_command(const std::string& subject, const std::string& cmd, size_t& chan)
+{
+	// C1 / C2 share their commands
+	const char* subj = subject.c_str();
+	size_t subj_len = subject.size();
+	if(subj_len == 2 && subj[0] == 'C' && (subj[1] == '1' || subj[1] == '2'))
+	{
+		chan = subj[1] - '1';
+		subj_len = 1;
+	}
+
+	ScpiCommand command;
+	switch(hash(subj, subj_len, cmd))
+	{
+#define SCPI_CASE_ENTRY(id, subject, cmd) case key(id): command = id; break;
+		SCPI_COMMAND_LIST(SCPI_CASE_ENTRY)
+#undef SCPI_CASE_ENTRY
+		default: return SCPI_UNKNOWN;
+	}
+
+	// Anything else may hash the same as one of ours
+	const ScpiCommandName& name = SCPI_COMMAND_NAMES[command];
+	if(strlen(name.subject) != subj_len || strncmp(name.subject, subj, subj_len) != 0 || cmd != name.cmd)
+	{
+		return SCPI_UNKNOWN;
+	}
+	return command;
+}
+
+bool scpi_parse_bool(const std::string& arg)
+{
+	return arg == "ON" || arg == "1";
+}
+
+bool scpi_parse_uint(const std::string& arg, uint64_t& out, uint64_t min, uint64_t max)
+{
+	// strtoull() takes leading spaces and negates a '-'
+	if(arg.empty() || arg[0] < '0' || arg[0] > '9')
+	{
+		return false;
+	}
+	char* end;
+	errno = 0;
+	unsigned long long value = strtoull(arg.c_str(), &end, 10);
+	if(*end != '\0' || errno == ERANGE || value < min || value > max)
+	{
+		return false;
+	}
+	out = value;
+	return true;
+}
+
+bool scpi_parse_int(const std::string& arg, int64_t& out, int64_t min, int64_t max)
+{
+	if(arg.empty() || isspace(static_cast<unsigned char>(arg[0])))
+	{
+		return false;
+	}
+	char* end;
+	errno = 0;
+	long long value = strtoll(arg.c_str(), &end, 10);
+	if(*end != '\0' || errno == ERANGE || value < min || value > max)
+	{
+		return false;
+	}
+	out = value;
+	return true;
+}
+
+// Built with -ffast-math, which lets std::isfinite() fold to true. An all ones
+// exponent is inf or NaN, whatever the compiler assumes.
+static bool is_finite_bits(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return ((bits >> 52) & 0x7FF) != 0x7FF;
+}
+
+bool scpi_parse_double(const std::string& arg, double& out)
+{
+	if(arg.empty() || isspace(static_cast<unsigned char>(arg[0])))
+	{
+		return false;
+	}
+	char* end;
+	double value = strtod(arg.c_str(), &end);
+	if(*end != '\0' || !is_finite_bits(value))
+	{
+		return false;
+	}
+	out = value;
+	return true;
+}
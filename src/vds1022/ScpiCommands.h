@@ -0,0 +1,133 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// OWON specific SCPI commands and queries, for dispatching with a switch
+// instead of comparing the line against every command in turn.
+//
+// Every command is hashed at compile time (FNV-1a of subject:command, with
+// channel subjects C1 / C2 as C). The hashes are the case labels of the
+// lookup, so a collision between two commands fails to compile, and an
+// incoming line costs one hash and one string comparison whatever the
+// number of commands. Nothing is allocated.
+//
+// Every command as X(enum value, subject, command). The enum, the names and
+// the case labels of the lookup are all generated from it.
+#define SCPI_COMMAND_LIST(X) \
+	/* Channel (C1 / C2) commands and queries */ \
+	X(SCPI_CH_FREQ, "C", "FREQ") \
+	X(SCPI_CH_PERIOD, "C", "PERIOD") \
+	X(SCPI_CH_PEAK, "C", "PEAK") \
+	X(SCPI_CH_MASKSTATS, "C", "MASKSTATS") \
+	X(SCPI_CH_FILTER, "C", "FILTER") \
+	X(SCPI_CH_MASKUPPER, "C", "MASKUPPER") \
+	X(SCPI_CH_MASKLOWER, "C", "MASKLOWER") \
+	X(SCPI_CH_MASKPOLY, "C", "MASKPOLY") \
+	X(SCPI_CH_MASKCLEAR, "C", "MASKCLEAR") \
+	/* Same order as FrameMeasurements::Measurement */ \
+	X(SCPI_CH_MIN, "C", "MIN") \
+	X(SCPI_CH_MAX, "C", "MAX") \
+	X(SCPI_CH_VPP, "C", "VPP") \
+	X(SCPI_CH_MEAN, "C", "MEAN") \
+	X(SCPI_CH_RMS, "C", "RMS") \
+	X(SCPI_CH_RISE, "C", "RISE") \
+	X(SCPI_CH_FALL, "C", "FALL") \
+	X(SCPI_CH_DUTY, "C", "DUTY") \
+	X(SCPI_CH_CROSSINGS, "C", "CROSSINGS") \
+	\
+	X(SCPI_ROLL, "", "ROLL") \
+	X(SCPI_ROLL_LATENCY, "ROLL", "LATENCY") \
+	X(SCPI_AUTOSET, "", "AUTOSET") \
+	X(SCPI_AVG_MODE, "AVG", "MODE") \
+	X(SCPI_AVG_COUNT, "AVG", "COUNT") \
+	X(SCPI_DECIM_POINTS, "DECIM", "POINTS") \
+	X(SCPI_FREQ_WINDOW, "FREQ", "WINDOW") \
+	X(SCPI_SCHED_ACQ, "SCHED", "ACQ") \
+	X(SCPI_SCHED_WORKERS, "SCHED", "WORKERS") \
+	X(SCPI_SCHED_SCPI, "SCHED", "SCPI") \
+	X(SCPI_SCHED_MLOCK, "SCHED", "MLOCK") \
+	X(SCPI_SCHED_RESET, "SCHED", "RESET") \
+	X(SCPI_SCHED_LATENCY, "SCHED", "LATENCY") \
+	X(SCPI_REC_START, "REC", "START") \
+	X(SCPI_REC_STOP, "REC", "STOP") \
+	X(SCPI_REC_STATUS, "REC", "STATUS") \
+	X(SCPI_PERSIST, "", "PERSIST") \
+	X(SCPI_PERSIST_INTERVAL, "PERSIST", "INTERVAL") \
+	X(SCPI_PERSIST_BINS, "PERSIST", "BINS") \
+	X(SCPI_PERSIST_ALIGN, "PERSIST", "ALIGN") \
+	X(SCPI_PERSIST_RESET, "PERSIST", "RESET") \
+	X(SCPI_INTERP, "", "INTERP") \
+	X(SCPI_INTERP_FACTOR, "INTERP", "FACTOR") \
+	X(SCPI_INTERP_TAPS, "INTERP", "TAPS") \
+	X(SCPI_INTERP_SPAN, "INTERP", "SPAN") \
+	X(SCPI_MASK, "", "MASK") \
+	X(SCPI_MASK_SENDFAIL, "MASK", "SENDFAIL") \
+	X(SCPI_MASK_RESET, "MASK", "RESET") \
+	X(SCPI_FFT, "", "FFT") \
+	X(SCPI_FFT_WINDOW, "FFT", "WINDOW") \
+	X(SCPI_FFT_AVG, "FFT", "AVG") \
+	X(SCPI_MEAS_RESET, "MEAS", "RESET") \
+	X(SCPI_MEAS_STREAM, "MEAS", "STREAM") \
+	X(SCPI_ETS, "", "ETS") \
+	X(SCPI_ETS_FILL, "ETS", "FILL") \
+	X(SCPI_ETS_FACTOR, "ETS", "FACTOR") \
+	X(SCPI_ETS_LEVEL, "ETS", "LEVEL") \
+	X(SCPI_ETS_EDGE, "ETS", "EDGE") \
+	X(SCPI_ETS_RESET, "ETS", "RESET") \
+	X(SCPI_DELTA, "", "DELTA") \
+	X(SCPI_DELTA_THRESHOLD, "DELTA", "THRESHOLD") \
+	X(SCPI_DELTA_KEYFRAME, "DELTA", "KEYFRAME") \
+	X(SCPI_DELTA_STATS, "DELTA", "STATS") \
+	X(SCPI_FLOW, "", "FLOW") \
+	X(SCPI_FLOW_GRANT, "FLOW", "GRANT") \
+	X(SCPI_FLOW_STATS, "FLOW", "STATS") \
+	X(SCPI_DEADTIME, "", "DEADTIME") \
+	X(SCPI_DEADTIME_PROBE, "DEADTIME", "PROBE") \
+	X(SCPI_DEADTIME_RESET, "DEADTIME", "RESET") \
+	X(SCPI_PRESET, "", "PRESET") \
+	X(SCPI_PRESET_STORE, "PRESET", "STORE") \
+	X(SCPI_PRESET_APPLY, "PRESET", "APPLY") \
+	X(SCPI_PRESET_DELETE, "PRESET", "DELETE") \
+	X(SCPI_PRESET_LATENCY, "PRESET", "LATENCY")
+
+enum ScpiCommand
+{
+	SCPI_UNKNOWN,
+#define SCPI_ENUM_ENTRY(id, subject, cmd) id,
+	SCPI_COMMAND_LIST(SCPI_ENUM_ENTRY)
+#undef SCPI_ENUM_ENTRY
+	SCPI_NUM_COMMANDS
+};
+
+struct ScpiCommandName
+{
+	const char* subject;
+	const char* cmd;
+};
+
+// Indexed by ScpiCommand
+extern const ScpiCommandName SCPI_COMMAND_NAMES[];
+
+constexpr uint64_t scpi_fnv1a(const char* str, uint64_t hash)
+{
+	return *str == '\0' ? hash : scpi_fnv1a(str + 1, (hash ^ static_cast<uint8_t>(*str)) * 1099511628211ull);
+}
+
+constexpr uint64_t scpi_hash(const char* subject, const char* cmd)
+{
+	return scpi_fnv1a(cmd, (scpi_fnv1a(subject, 14695981039346656037ull) ^ ':') * 1099511628211ull);
+}
+
+// chan is set for channel commands
+ScpiCommand find_scpi_command(const std::string& subject, const std::string& cmd, size_t& chan);
+
+// ON or 1, anything else being off
+bool scpi_parse_bool(const std::string& arg);
+
+// Whole argument as a decimal number within min..max, out is left alone if
+// it isn't one. Arguments come from the client, so nothing here throws.
+bool scpi_parse_uint(const std::string& arg, uint64_t& out, uint64_t min, uint64_t max);
+bool scpi_parse_int(const std::string& arg, int64_t& out, int64_t min, int64_t max);
+// Finite values only
+bool scpi_parse_double(const std::string& arg, double& out);
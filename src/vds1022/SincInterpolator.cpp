@@ -0,0 +1,127 @@
+#include "SincInterpolator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+
+SincKernel::SincKernel(uint32_t _factor, uint32_t _taps)
+:	factor(_factor)
+,	taps(_taps)
+{
+	coeffs.resize(factor * taps);
+
+	const double half = taps / 2.0;
+	for(uint32_t p = 0; p < factor; p++)
+	{
+		float* h = &coeffs[p * taps];
+		double frac = static_cast<double>(p) / factor;
+		double sum = 0.0;
+		for(uint32_t k = 0; k < taps; k++)
+		{
+			// Distance from the output point to input sample n - taps / 2 + 1 + k
+			double x = (static_cast<double>(k) - half + 1.0) - frac;
+			double sinc = x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+			// Blackman window spanning all taps
+			double w = (x + half) / taps;
+			double window = 0.42 - 0.5 * std::cos(2 * M_PI * w) + 0.08 * std::cos(4 * M_PI * w);
+			h[k] = static_cast<float>(sinc * window);
+			sum += h[k];
+		}
+
+		// Unity DC gain on every phase
+		for(uint32_t k = 0; k < taps; k++)
+		{
+			h[k] = static_cast<float>(h[k] / sum);
+		}
+	}
+}
+
+std::shared_ptr<const SincKernel> SincKernel::get(uint32_t factor, uint32_t taps)
+{
+	static std::mutex mtx;
+	static std::map<std::pair<uint32_t, uint32_t>, std::shared_ptr<const SincKernel>> cache;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto key = std::make_pair(factor, taps);
+	auto it = cache.find(key);
+	if(it != cache.end())
+	{
+		return it->second;
+	}
+
+	auto kernel = std::make_shared<const SincKernel>(factor, taps);
+	cache[key] = kernel;
+	return kernel;
+}
+
+SincInterpolator::SincInterpolator()
+:	span(0)
+,	first(0)
+{
+	configure(4, 16, 250);
+}
+
+void SincInterpolator::configure(uint32_t factor, uint32_t taps, uint32_t _span)
+{
+	factor = factor < MIN_FACTOR ? MIN_FACTOR : (factor > MAX_FACTOR ? MAX_FACTOR : factor);
+	// Even tap counts keep the kernel centered between samples
+	taps = (taps < MIN_TAPS ? MIN_TAPS : (taps > MAX_TAPS ? MAX_TAPS : taps)) & ~1u;
+	span = _span > NUM_SAMPLES / 2 ? NUM_SAMPLES / 2 : _span;
+
+	kernel = SincKernel::get(factor, taps);
+
+	size_t points = span * 2;
+	input.assign(points + taps, 0.0f);
+	phase_out.assign(points, 0.0f);
+	output.assign(points * factor, 0);
+}
+
+size_t SincInterpolator::process(const AcquiredData& data)
+{
+	const uint32_t factor = kernel->get_factor();
+	const uint32_t taps = kernel->get_taps();
+	const size_t points = span * 2;
+
+	// Cursor gives where the trigger is, counting from the right of the whole buffer
+	int32_t trigger = static_cast<int32_t>(data.samples.size()) - static_cast<int32_t>(data.cursor) - 50;
+	trigger = std::max<int32_t>(span, std::min<int32_t>(trigger, NUM_SAMPLES - span));
+	first = trigger - static_cast<int32_t>(span);
+
+	// Input with taps / 2 samples of context on each side, taken from the
+	// pre / post samples if needed, clamped at the very edges
+	const int8_t* samples = reinterpret_cast<const int8_t*>(data.samples.data());
+	const int32_t buf_size = static_cast<int32_t>(data.samples.size());
+	const int32_t start = first + 50 - static_cast<int32_t>(taps / 2) + 1;
+	for(size_t i = 0; i < points + taps; i++)
+	{
+		int32_t idx = std::max(0, std::min(start + static_cast<int32_t>(i), buf_size - 1));
+		input[i] = samples[idx];
+	}
+
+	// One pass per phase, where the inner loop runs over contiguous outputs
+	// so it vectorizes
+	for(uint32_t p = 0; p < factor; p++)
+	{
+		const float* h = kernel->get_phase(p);
+		float* out = phase_out.data();
+		std::fill(phase_out.begin(), phase_out.end(), 0.0f);
+		for(uint32_t k = 0; k < taps; k++)
+		{
+			const float c = h[k];
+			const float* in = input.data() + k;
+			for(size_t n = 0; n < points; n++)
+			{
+				out[n] += c * in[n];
+			}
+		}
+
+		for(size_t n = 0; n < points; n++)
+		{
+			float v = std::max(-32768.0f, std::min(out[n] * 256.0f, 32767.0f));
+			output[n * factor + p] = static_cast<int16_t>(std::lround(v));
+		}
+	}
+
+	return points * factor;
+}
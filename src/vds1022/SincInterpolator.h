@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Driver.h"
+
+// Windowed sinc FIR coefficients for upsampling by factor, split in one
+// phase per output point between two input samples. Tables are cached
+// like FFT plans, as they only depend on the factor and tap count.
+class SincKernel
+{
+public:
+	SincKernel(uint32_t factor, uint32_t taps);
+
+	static std::shared_ptr<const SincKernel> get(uint32_t factor, uint32_t taps);
+
+	uint32_t get_factor() const { return factor; }
+	uint32_t get_taps() const { return taps; }
+
+	// taps coefficients of a phase, applied to input samples
+	// n - taps / 2 + 1 to n + taps / 2 to get output point n + phase / factor
+	const float* get_phase(uint32_t phase) const { return coeffs.data() + phase * taps; }
+
+protected:
+
+	uint32_t factor;
+	uint32_t taps;
+	std::vector<float> coeffs;
+};
+
+// Sin(x)/x interpolation of the part of a frame around the trigger, so the
+// cost only depends on how much of the frame is wanted.
+class SincInterpolator
+{
+public:
+	static const uint32_t MIN_FACTOR = 2;
+	static const uint32_t MAX_FACTOR = 16;
+	static const uint32_t MIN_TAPS = 4;
+	static const uint32_t MAX_TAPS = 64;
+	static const size_t NUM_SAMPLES = 5000;
+
+	SincInterpolator();
+
+	// span is how many input samples to interpolate on each side of the trigger
+	void configure(uint32_t factor, uint32_t taps, uint32_t span);
+
+	uint32_t get_factor() const { return kernel->get_factor(); }
+	uint32_t get_taps() const { return kernel->get_taps(); }
+	uint32_t get_span() const { return span; }
+
+	// Returns the number of output points, starting at input sample get_first()
+	size_t process(const AcquiredData& data);
+	int32_t get_first() const { return first; }
+
+	// In 1/256 of an ADC code
+	const int16_t* get_output() const { return output.data(); }
+
+protected:
+
+	std::shared_ptr<const SincKernel> kernel;
+	uint32_t span;
+	int32_t first;
+
+	std::vector<float> input;
+	std::vector<float> phase_out;
+	std::vector<int16_t> output;
+};
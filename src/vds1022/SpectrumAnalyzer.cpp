@@ -0,0 +1,157 @@
+#include "SpectrumAnalyzer.h"
+
+#include <algorithm>
+#include <cmath>
+
+SpectrumAnalyzer::SpectrumAnalyzer()
+:	window(HANN)
+,	averages(1)
+,	frames(0)
+{
+	size_t n = 1;
+	while(n < NUM_SAMPLES)
+	{
+		n *= 2;
+	}
+	plan = FFTPlan::get(n);
+
+	input.assign(n, 0.0f);
+	re.resize(n / 2 + 1);
+	im.resize(n / 2 + 1);
+	scratch_re.resize(n / 2);
+	scratch_im.resize(n / 2);
+	power.assign(n / 2 + 1, 0.0f);
+	spectrum.assign(n / 2 + 1, 0.0f);
+
+	configure(window, averages);
+}
+
+void SpectrumAnalyzer::configure(Window _window, uint32_t _averages)
+{
+	window = _window;
+	averages = _averages < 1 ? 1 : _averages;
+
+	coeffs.resize(NUM_SAMPLES);
+	const double m = NUM_SAMPLES - 1;
+	for(size_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		double x = 2.0 * M_PI * i / m;
+		double w;
+		switch(window)
+		{
+			case HANN:
+				w = 0.5 - 0.5 * std::cos(x);
+				break;
+
+			case BLACKMAN_HARRIS:
+				w = 0.35875 - 0.48829 * std::cos(x) + 0.14128 * std::cos(2 * x) - 0.01168 * std::cos(3 * x);
+				break;
+
+			case FLAT_TOP:
+				w = 0.21557895 - 0.41663158 * std::cos(x) + 0.277263158 * std::cos(2 * x)
+					- 0.083578947 * std::cos(3 * x) + 0.006947368 * std::cos(4 * x);
+				break;
+
+			default:
+				w = 1.0;
+				break;
+		}
+		coeffs[i] = static_cast<float>(w);
+	}
+
+	// Normalize to the coherent gain so a sine reads the same with every window
+	double sum = 0.0;
+	for(float c : coeffs)
+	{
+		sum += c;
+	}
+	for(auto& c : coeffs)
+	{
+		c = static_cast<float>(c / sum);
+	}
+
+	reset();
+}
+
+void SpectrumAnalyzer::reset()
+{
+	std::fill(power.begin(), power.end(), 0.0f);
+	frames = 0;
+}
+
+bool SpectrumAnalyzer::push_frame(const AcquiredData& data)
+{
+	// Skip the 50 pre samples
+	const int8_t* samples = reinterpret_cast<const int8_t*>(data.samples.data() + 50);
+	for(size_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		input[i] = samples[i] * coeffs[i];
+	}
+
+	return transform();
+}
+
+bool SpectrumAnalyzer::push_samples(const float* samples)
+{
+	for(size_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		input[i] = samples[i] * coeffs[i];
+	}
+
+	return transform();
+}
+
+bool SpectrumAnalyzer::transform()
+{
+	plan->forward(input.data(), re.data(), im.data(), scratch_re.data(), scratch_im.data());
+
+	const size_t bins = power.size();
+	for(size_t k = 0; k < bins; k++)
+	{
+		power[k] += re[k] * re[k] + im[k] * im[k];
+	}
+
+	if(++frames < averages)
+	{
+		return false;
+	}
+
+	// One sided spectrum, a sine of amplitude A shows up as A / 2 in its bin,
+	// so the RMS power is 2 * |X|^2
+	const float scale = 2.0f / frames;
+	for(size_t k = 0; k < bins; k++)
+	{
+		spectrum[k] = 10.0f * std::log10(power[k] * scale + 1e-20f);
+	}
+
+	reset();
+	return true;
+}
+
+double SpectrumAnalyzer::get_peak(float& level_db) const
+{
+	size_t best = 1;
+	for(size_t k = 2; k + 1 < spectrum.size(); k++)
+	{
+		if(spectrum[k] > spectrum[best])
+		{
+			best = k;
+		}
+	}
+
+	level_db = spectrum[best];
+	double offset = 0.0;
+	if(best + 1 < spectrum.size())
+	{
+		float a = spectrum[best - 1];
+		float b = spectrum[best];
+		float c = spectrum[best + 1];
+		float denom = a - 2 * b + c;
+		if(denom != 0.0f)
+		{
+			offset = 0.5 * (a - c) / denom;
+		}
+	}
+
+	return (best + offset) / plan->get_size();
+}
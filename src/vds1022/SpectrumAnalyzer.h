@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Driver.h"
+#include "FFT.h"
+
+// Power spectrum of the frames of a channel. Frames are windowed, zero
+// padded to the next power of two and transformed, and the power of a
+// number of frames is averaged before producing a spectrum.
+// Levels are in dB relative to a sine of 1 ADC code RMS.
+class SpectrumAnalyzer
+{
+public:
+	enum Window
+	{
+		RECTANGULAR,
+		HANN,
+		BLACKMAN_HARRIS,
+		FLAT_TOP,
+	};
+
+	static const size_t NUM_SAMPLES = 5000;
+
+	SpectrumAnalyzer();
+
+	// Also clears the averages
+	void configure(Window window, uint32_t averages);
+	void reset();
+
+	Window get_window() const { return window; }
+	uint32_t get_averages() const { return averages; }
+
+	// Returns true once a new averaged spectrum is ready
+	bool push_frame(const AcquiredData& data);
+	// NUM_SAMPLES samples, in ADC codes
+	bool push_samples(const float* samples);
+
+	size_t get_num_bins() const { return spectrum.size(); }
+	size_t get_fft_size() const { return plan->get_size(); }
+	const float* get_spectrum() const { return spectrum.data(); }
+
+	// Strongest bin other than DC of the last spectrum, refined with a
+	// parabolic fit, as a fraction of the sample rate
+	double get_peak(float& level_db) const;
+
+protected:
+
+	// Transforms the windowed samples in input and accumulates their power
+	bool transform();
+
+	Window window;
+	uint32_t averages;
+	uint32_t frames;
+
+	std::shared_ptr<const FFTPlan> plan;
+	std::vector<float> coeffs;
+
+	std::vector<float> input;
+	std::vector<float> re;
+	std::vector<float> im;
+	std::vector<float> scratch_re;
+	std::vector<float> scratch_im;
+	std::vector<float> power;
+	std::vector<float> spectrum;
+};
@@ -0,0 +1,202 @@
+#include "TaskPool.h"
+
+#include <chrono>
+
+static int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Worker running on this thread, so tasks it submits stay on its own queue
+static thread_local TaskPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+TaskPool::Queue::Queue()
+:	ring(256)
+,	head(0)
+,	count(0)
+{
+}
+
+void TaskPool::Queue::push(const Task& task)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if(count == ring.size())
+	{
+		// Unwrap into a ring twice as big, only happens until the working size is reached
+		std::vector<Task> bigger(ring.size() * 2);
+		for(size_t i = 0; i < count; i++)
+		{
+			bigger[i] = ring[(head + i) % ring.size()];
+		}
+		ring.swap(bigger);
+		head = 0;
+	}
+	ring[(head + count) % ring.size()] = task;
+	count++;
+}
+
+bool TaskPool::Queue::pop_back(Task& task)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if(count == 0)
+	{
+		return false;
+	}
+	count--;
+	task = ring[(head + count) % ring.size()];
+	return true;
+}
+
+bool TaskPool::Queue::pop_front(Task& task)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if(count == 0)
+	{
+		return false;
+	}
+	task = ring[head];
+	head = (head + 1) % ring.size();
+	count--;
+	return true;
+}
+
+TaskPool::TaskPool(size_t num_workers)
+:	next_queue(0)
+,	pending(0)
+,	sleeping(0)
+,	quit(false)
+,	executed(0)
+,	stolen(0)
+{
+	if(num_workers == 0)
+	{
+		num_workers = std::thread::hardware_concurrency();
+	}
+	if(num_workers == 0)
+	{
+		num_workers = 1;
+	}
+
+	for(size_t i = 0; i < num_workers; i++)
+	{
+		queues.emplace_back(new Queue());
+	}
+	for(size_t i = 0; i < num_workers; i++)
+	{
+		threads.emplace_back(&TaskPool::worker_main, this, i);
+	}
+}
+
+TaskPool::~TaskPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mtx);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for(auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+TaskPool& TaskPool::get()
+{
+	static TaskPool pool;
+	return pool;
+}
+
+void TaskPool::submit(TaskFunc fn, void* ctx, uintptr_t arg)
+{
+	size_t queue;
+	if(current_pool == this)
+	{
+		queue = current_worker;
+	}
+	else
+	{
+		queue = next_queue++ % queues.size();
+	}
+
+	// Counted before it is queued, so a worker never sees more tasks than announced
+	pending++;
+	queues[queue]->push(Task{fn, ctx, arg, now_ns()});
+
+	if(sleeping > 0)
+	{
+		// Taking the lock makes sure the sleeper is either waiting or will see the task
+		{
+			std::lock_guard<std::mutex> lock(sleep_mtx);
+		}
+		wake.notify_one();
+	}
+}
+
+bool TaskPool::place_workers(const ThreadPlacement& placement)
+{
+	bool ok = true;
+	for(size_t i = 0; i < threads.size(); i++)
+	{
+		ok &= placement.apply(threads[i], i);
+	}
+	return ok;
+}
+
+bool TaskPool::find_task(size_t worker, Task& task, bool& was_stolen)
+{
+	was_stolen = false;
+	if(queues[worker]->pop_back(task))
+	{
+		return true;
+	}
+
+	for(size_t i = 1; i < queues.size(); i++)
+	{
+		if(queues[(worker + i) % queues.size()]->pop_front(task))
+		{
+			was_stolen = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+void TaskPool::worker_main(size_t worker)
+{
+	current_pool = this;
+	current_worker = worker;
+
+	while(true)
+	{
+		Task task;
+		bool was_stolen;
+		if(find_task(worker, task, was_stolen))
+		{
+			pending--;
+			int64_t waited = now_ns() - task.queued_ns;
+			dispatch_latency.add(waited > 0 ? static_cast<uint64_t>(waited) : 0);
+			task.fn(task.ctx, task.arg);
+			executed++;
+			if(was_stolen)
+			{
+				stolen++;
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mtx);
+		sleeping++;
+		while(!quit && pending == 0)
+		{
+			wake.wait(lock);
+		}
+		sleeping--;
+		if(quit && pending == 0)
+		{
+			return;
+		}
+	}
+}
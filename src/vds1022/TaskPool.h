@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LatencyTracker.h"
+#include "ThreadPlacement.h"
+
+// Fixed set of worker threads running small tasks. Every worker has its own
+// queue: tasks submitted from a worker go to its queue and are run newest first
+// (their data is still in cache), idle workers steal the oldest tasks of the
+// others. Tasks are a function pointer, two words and a timestamp, so scheduling
+// one never allocates once the queues have grown to their working size.
+//
+// OpenMP tasks would need every frame to be submitted from inside a parallel
+// region, which the USB thread is not, hence the pool of plain threads.
+class TaskPool
+{
+public:
+	typedef void (*TaskFunc)(void* ctx, uintptr_t arg);
+
+	// 0 to use one worker per hardware thread
+	explicit TaskPool(size_t num_workers = 0);
+	~TaskPool();
+
+	// Shared by all devices, sized to the machine
+	static TaskPool& get();
+
+	size_t get_num_workers() const { return queues.size(); }
+
+	void submit(TaskFunc fn, void* ctx, uintptr_t arg);
+
+	// Tasks run so far, and how many of them were stolen from another worker
+	uint64_t get_executed() const { return executed; }
+	uint64_t get_stolen() const { return stolen; }
+
+	// Pins the workers, each to one CPU of the list in turn
+	bool place_workers(const ThreadPlacement& placement);
+
+	// Time from a task being submitted to a worker starting it
+	LatencyTracker& get_dispatch_latency() { return dispatch_latency; }
+
+protected:
+
+	struct Task
+	{
+		TaskFunc fn;
+		void* ctx;
+		uintptr_t arg;
+		int64_t queued_ns;
+	};
+
+	// Ring of tasks, the owner works at the back and thieves at the front
+	struct Queue
+	{
+		Queue();
+
+		void push(const Task& task);
+		bool pop_back(Task& task);
+		bool pop_front(Task& task);
+
+		std::mutex mtx;
+		std::vector<Task> ring;
+		size_t head;
+		size_t count;
+	};
+
+	bool find_task(size_t worker, Task& task, bool& was_stolen);
+	void worker_main(size_t worker);
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> threads;
+
+	// Queue used for tasks submitted from outside of the pool
+	std::atomic<size_t> next_queue;
+	// Tasks queued but not started yet
+	std::atomic<size_t> pending;
+
+	std::mutex sleep_mtx;
+	std::condition_variable wake;
+	std::atomic<size_t> sleeping;
+	bool quit;
+
+	std::atomic<uint64_t> executed;
+	std::atomic<uint64_t> stolen;
+	LatencyTracker dispatch_latency;
+};
@@ -0,0 +1,254 @@
+#include "ThreadPlacement.h"
+
+#include <log.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+ThreadPlacement::ThreadPlacement()
+:	policy(OTHER)
+,	priority(0)
+{
+}
+
+static bool parse_int(const std::string& str, int& out)
+{
+	if(str.empty())
+	{
+		return false;
+	}
+	char* end;
+	long value = strtol(str.c_str(), &end, 10);
+	if(*end != '\0' || value < 0 || value > 1023)
+	{
+		return false;
+	}
+	out = static_cast<int>(value);
+	return true;
+}
+
+static std::string to_upper(const std::string& str)
+{
+	std::string ret;
+	for(char c : str)
+	{
+		ret += static_cast<char>(toupper(static_cast<unsigned char>(c)));
+	}
+	return ret;
+}
+
+bool ThreadPlacement::parse(const std::string& cpu_list, const std::string& policy_name, const std::string& prio)
+{
+	std::vector<int> new_cpus;
+	std::string list = to_upper(cpu_list);
+
+	if(list != "ANY")
+	{
+		size_t start = 0;
+		while(start <= list.size())
+		{
+			size_t end = list.find('+', start);
+			if(end == std::string::npos)
+			{
+				end = list.size();
+			}
+			std::string part = list.substr(start, end - start);
+			start = end + 1;
+
+			size_t dash = part.find('-');
+			int first;
+			int last;
+			if(dash == std::string::npos)
+			{
+				if(!parse_int(part, first))
+				{
+					return false;
+				}
+				last = first;
+			}
+			else if(!parse_int(part.substr(0, dash), first) || !parse_int(part.substr(dash + 1), last) || last < first)
+			{
+				return false;
+			}
+
+			for(int cpu = first; cpu <= last; cpu++)
+			{
+				new_cpus.push_back(cpu);
+			}
+		}
+	}
+
+	Policy new_policy;
+	std::string name = to_upper(policy_name);
+	if(name.empty() || name == "OTHER")
+	{
+		new_policy = OTHER;
+	}
+	else if(name == "FIFO")
+	{
+		new_policy = FIFO;
+	}
+	else if(name == "RR")
+	{
+		new_policy = RR;
+	}
+	else
+	{
+		return false;
+	}
+
+	int new_priority = 0;
+	if(new_policy != OTHER)
+	{
+		// Middle of the range, above the usual IRQ threads but not above watchdogs
+		new_priority = 50;
+		if(!prio.empty() && (!parse_int(prio, new_priority) || new_priority < 1 || new_priority > 99))
+		{
+			return false;
+		}
+	}
+
+	cpus = new_cpus;
+	policy = new_policy;
+	priority = new_priority;
+	return true;
+}
+
+bool ThreadPlacement::parse(const std::string& spec)
+{
+	std::string fields[3];
+	size_t field = 0;
+	for(char c : spec)
+	{
+		if(c != ',')
+		{
+			fields[field] += c;
+		}
+		else if(++field >= 3)
+		{
+			return false;
+		}
+	}
+	return parse(fields[0], fields[1], fields[2]);
+}
+
+std::string ThreadPlacement::to_string() const
+{
+	static const char* policies[] = {"OTHER", "FIFO", "RR"};
+
+	std::string ret;
+	for(size_t i = 0; i < cpus.size(); i++)
+	{
+		ret += (i > 0 ? "+" : "") + std::to_string(cpus[i]);
+	}
+	if(ret.empty())
+	{
+		ret = "ANY";
+	}
+	return ret + "," + policies[policy] + "," + std::to_string(priority);
+}
+
+bool ThreadPlacement::apply(std::thread& thread, size_t index) const
+{
+	return apply_native(thread.native_handle(), index);
+}
+
+bool ThreadPlacement::apply_current(size_t index) const
+{
+#ifdef __linux__
+	return apply_native(pthread_self(), index);
+#else
+	return apply_native(std::thread::native_handle_type(), index);
+#endif
+}
+
+#ifdef __linux__
+
+bool ThreadPlacement::apply_native(std::thread::native_handle_type handle, size_t index) const
+{
+	bool ok = true;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(cpus.empty())
+	{
+		// Back to every CPU, in case it was pinned before
+		long count = sysconf(_SC_NPROCESSORS_CONF);
+		for(long cpu = 0; cpu < count && cpu < CPU_SETSIZE; cpu++)
+		{
+			CPU_SET(cpu, &set);
+		}
+	}
+	else if(index != SIZE_MAX)
+	{
+		CPU_SET(cpus[index % cpus.size()], &set);
+	}
+	else
+	{
+		for(int cpu : cpus)
+		{
+			CPU_SET(cpu, &set);
+		}
+	}
+
+	int r = pthread_setaffinity_np(handle, sizeof(set), &set);
+	if(r != 0)
+	{
+		LogWarning("Unable to set CPU affinity to %s: %s\n", to_string().c_str(), strerror(r));
+		ok = false;
+	}
+
+	sched_param param{};
+	param.sched_priority = priority;
+	int native_policy = policy == FIFO ? SCHED_FIFO : (policy == RR ? SCHED_RR : SCHED_OTHER);
+	r = pthread_setschedparam(handle, native_policy, &param);
+	if(r != 0)
+	{
+		LogWarning("Unable to set scheduling to %s: %s\n", to_string().c_str(), strerror(r));
+		ok = false;
+	}
+
+	return ok;
+}
+
+bool ThreadPlacement::lock_memory(bool lock)
+{
+	int r = lock ? mlockall(MCL_CURRENT | MCL_FUTURE) : munlockall();
+	if(r != 0)
+	{
+		LogWarning("Unable to %s memory: %s\n", lock ? "lock" : "unlock", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+#else
+
+bool ThreadPlacement::apply_native(std::thread::native_handle_type handle, size_t index) const
+{
+	if(!is_default())
+	{
+		LogWarning("Thread placement is only supported on Linux\n");
+		return false;
+	}
+	return true;
+}
+
+bool ThreadPlacement::lock_memory(bool lock)
+{
+	if(lock)
+	{
+		LogWarning("Memory locking is only supported on Linux\n");
+	}
+	return !lock;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// CPUs a thread may run on and its scheduling policy. Only supported on
+// Linux, elsewhere applying anything but the default fails.
+//
+// Real-time policies need CAP_SYS_NICE (or an rtprio limit), pinning works
+// for any user.
+class ThreadPlacement
+{
+public:
+	enum Policy
+	{
+		OTHER,
+		FIFO,
+		RR
+	};
+
+	ThreadPlacement();
+
+	// cpus as "2", "0-3", "1+5" or "ANY"; policy as OTHER, FIFO or RR;
+	// priority 1 to 99 for FIFO and RR. Returns false if anything is invalid.
+	bool parse(const std::string& cpus, const std::string& policy, const std::string& priority);
+	// Same, from "<cpus>[,<policy>[,<priority>]]" as given on the command line
+	bool parse(const std::string& spec);
+	std::string to_string() const;
+
+	bool is_default() const { return cpus.empty() && policy == OTHER; }
+
+	// Applies to a running thread. If index is given, the thread is pinned to
+	// the index-th CPU of the list only, so a set of workers gets one each.
+	bool apply(std::thread& thread, size_t index = SIZE_MAX) const;
+	bool apply_current(size_t index = SIZE_MAX) const;
+
+	// Keeps every page of the process (current and future) in RAM, so the
+	// frame pools never page fault
+	static bool lock_memory(bool lock);
+
+protected:
+
+	bool apply_native(std::thread::native_handle_type handle, size_t index) const;
+
+	std::vector<int> cpus;
+	Policy policy;
+	int priority;
+};
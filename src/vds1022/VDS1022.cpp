@@ -0,0 +1,698 @@
+#include "VDS1022.h"
+#include "Autoset.h"
+
+#include <log.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+VDS1022::VDS1022(size_t num_frames)
+:	opened(false)
+,	config{}
+,	recorded_generation(0)
+,	replay_open(false)
+,	replay_realtime(true)
+,	replay_roll(false)
+,	replay_done(false)
+,	generation(0)
+,	sample_rate(250000)
+,	probe_phases(false)
+,	running(false)
+,	quit(false)
+,	active(nullptr)
+,	own_pipeline(num_frames)
+,	ready(num_frames, nullptr)
+,	ready_head(0)
+,	ready_count(0)
+{
+	// Without stages frames go straight to the queue get_frame() reads from
+	own_pipeline.set_deliver([this](PipelineFrame& frame)
+	{
+		{
+			std::lock_guard<std::mutex> lock(ready_mtx);
+			ready[(ready_head + ready_count) % ready.size()] = &frame;
+			ready_count++;
+		}
+		ready_cond.notify_one();
+	});
+}
+
+VDS1022::~VDS1022()
+{
+	close();
+}
+
+bool VDS1022::open()
+{
+	if(opened)
+	{
+		return true;
+	}
+
+	// Reference counted by libusb, the driver exits it when closed
+	if(libusb_init_context(nullptr, nullptr, 0) < 0)
+	{
+		return false;
+	}
+	if(!driver.init_findany())
+	{
+		libusb_exit(nullptr);
+		return false;
+	}
+	config.ranges[0] = static_cast<uint8_t>(driver.get_channel_range(0));
+	config.ranges[1] = static_cast<uint8_t>(driver.get_channel_range(1));
+	opened = true;
+	return true;
+}
+
+bool VDS1022::open_replay(const std::string& path, bool realtime)
+{
+	if(opened)
+	{
+		return false;
+	}
+
+	if(!replay.open(path))
+	{
+		return false;
+	}
+	replay_open = true;
+	replay_realtime = realtime;
+	replay_done = false;
+	opened = true;
+	return true;
+}
+
+void VDS1022::close()
+{
+	stop();
+	stop_recording();
+	if(opened)
+	{
+		if(replay_open)
+		{
+			replay.close();
+			replay_open = false;
+		}
+		else
+		{
+			driver.deinit();
+		}
+		opened = false;
+	}
+}
+
+bool VDS1022::set_sampling(int32_t rate_hz, bool peak_detect, bool roll)
+{
+	int32_t rate = Driver::find_sample_rate(rate_hz > 0 ? static_cast<uint64_t>(rate_hz) : 0);
+	if(rate == 0)
+	{
+		LogError("Sample rate %d Hz is below the slowest the device does\n", rate_hz);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(device_mtx);
+	if(replay_open)
+	{
+		// The recording decides
+		return false;
+	}
+	if(!driver.push_sampling_config(rate, peak_detect, roll))
+	{
+		LogError("Unable to set the sampling\n");
+		return false;
+	}
+	config.sample_rate = static_cast<uint64_t>(rate);
+	config.peak_detect = peak_detect ? 1 : 0;
+	config.roll = roll ? 1 : 0;
+	sample_rate = static_cast<uint64_t>(rate);
+	generation++;
+	return true;
+}
+
+bool VDS1022::set_trigger(const TriggerConfig& trigger)
+{
+	std::lock_guard<std::mutex> lock(device_mtx);
+	if(replay_open)
+	{
+		return false;
+	}
+	if(!driver.push_trigger_config(trigger))
+	{
+		LogError("Unable to set the trigger\n");
+		return false;
+	}
+	config.trigger = trigger;
+	generation++;
+	return true;
+}
+
+bool VDS1022::is_roll_mode()
+{
+	std::lock_guard<std::mutex> lock(device_mtx);
+	return replay_open ? replay_roll : driver.is_roll_mode();
+}
+
+bool VDS1022::set_range(uint8_t ch, size_t range)
+{
+	std::lock_guard<std::mutex> lock(device_mtx);
+	if(replay_open)
+	{
+		return false;
+	}
+	if(!driver.push_channel_range(ch, range))
+	{
+		LogError("Unable to set the range of channel %u\n", ch + 1);
+		return false;
+	}
+	config.ranges[ch] = static_cast<uint8_t>(range);
+	generation++;
+	return true;
+}
+
+size_t VDS1022::get_range(uint8_t ch)
+{
+	std::lock_guard<std::mutex> lock(device_mtx);
+	return replay_open ? config.ranges[ch] : driver.get_channel_range(ch);
+}
+
+VDS1022::AutosetResult VDS1022::autoset(unsigned int max_acquisitions)
+{
+	AutosetResult result{};
+	if(!opened || replay_open)
+	{
+		return result;
+	}
+
+	// Frames are read here, so they can be matched with the ranges they were taken with
+	FramePipeline* pipeline = active;
+	bool was_running = running;
+	stop();
+
+	{
+		std::lock_guard<std::mutex> lock(device_mtx);
+		Autoset search;
+		AcquiredData data[2];
+		size_t pushed[2] = {driver.get_channel_range(0), driver.get_channel_range(1)};
+		const size_t original[2] = {pushed[0], pushed[1]};
+
+		// Roll mode and the slow rates would hardly finish a frame before the deadline
+		driver.push_sampling_config(Autoset::SEARCH_RATE, false, false);
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+		while(result.acquisitions < max_acquisitions && !search.is_settled() &&
+			std::chrono::steady_clock::now() < deadline)
+		{
+			for(uint8_t ch = 0; ch < 2; ch++)
+			{
+				if(search.get_range(ch) != pushed[ch])
+				{
+					driver.push_channel_range(ch, search.get_range(ch));
+					pushed[ch] = search.get_range(ch);
+				}
+			}
+
+			Driver::DataReadResult read = driver.get_data(data[0], data[1], 100);
+			if(read.kind != Driver::DataReadResult::OKAY)
+			{
+				if(read.kind != Driver::DataReadResult::TIMEOUT)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+				continue;
+			}
+			result.acquisitions++;
+			search.push_frame(read.has_ch1 ? &data[0] : nullptr, read.has_ch2 ? &data[1] : nullptr);
+		}
+
+		if(result.acquisitions == 0)
+		{
+			// Nothing to go by, put the setup back as it was
+			for(uint8_t ch = 0; ch < 2; ch++)
+			{
+				if(original[ch] != pushed[ch])
+				{
+					driver.push_channel_range(ch, original[ch]);
+				}
+				result.ranges[ch] = original[ch];
+			}
+			result.sample_rate = static_cast<int32_t>(sample_rate);
+			driver.push_sampling_config(result.sample_rate, config.peak_detect != 0, config.roll != 0);
+			generation++;
+		}
+		else
+		{
+			// The last frame may have moved a range that wasn't acquired with yet
+			for(uint8_t ch = 0; ch < 2; ch++)
+			{
+				if(search.get_range(ch) != pushed[ch])
+				{
+					driver.push_channel_range(ch, search.get_range(ch));
+				}
+				result.ranges[ch] = search.get_range(ch);
+				config.ranges[ch] = static_cast<uint8_t>(result.ranges[ch]);
+			}
+
+			result.frequency = search.get_frequency();
+			result.sample_rate = search.get_sample_rate(static_cast<int32_t>(sample_rate));
+			result.settled = search.is_settled();
+			driver.push_sampling_config(result.sample_rate, config.peak_detect != 0, config.roll != 0);
+			config.sample_rate = static_cast<uint64_t>(result.sample_rate);
+			sample_rate = static_cast<uint64_t>(result.sample_rate);
+			generation++;
+		}
+	}
+
+	if(was_running)
+	{
+		start(*pipeline);
+	}
+	return result;
+}
+
+VDS1022::Preset* VDS1022::find_preset(const std::string& name)
+{
+	for(auto& preset : presets)
+	{
+		if(preset.name == name)
+		{
+			return &preset;
+		}
+	}
+	return nullptr;
+}
+
+bool VDS1022::store_preset(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(device_mtx);
+	// Needs the calibration of a device
+	if(!opened || replay_open || name.empty())
+	{
+		return false;
+	}
+
+	Preset preset;
+	preset.name = name;
+	preset.config = config;
+	preset.config.sample_rate = sample_rate;
+	size_t ranges[2] = {driver.get_channel_range(0), driver.get_channel_range(1)};
+	preset.config.ranges[0] = static_cast<uint8_t>(ranges[0]);
+	preset.config.ranges[1] = static_cast<uint8_t>(ranges[1]);
+	driver.compile_image(ranges, static_cast<int32_t>(sample_rate), config.peak_detect != 0, config.roll != 0,
+		config.trigger, preset.image);
+
+	Preset* existing = find_preset(name);
+	if(existing != nullptr)
+	{
+		*existing = preset;
+	}
+	else
+	{
+		presets.push_back(preset);
+	}
+	return true;
+}
+
+bool VDS1022::delete_preset(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(device_mtx);
+	Preset* preset = find_preset(name);
+	if(preset == nullptr)
+	{
+		return false;
+	}
+	presets.erase(presets.begin() + (preset - presets.data()));
+	return true;
+}
+
+std::vector<std::string> VDS1022::get_preset_names()
+{
+	std::lock_guard<std::mutex> lock(device_mtx);
+	std::vector<std::string> names;
+	for(const auto& preset : presets)
+	{
+		names.push_back(preset.name);
+	}
+	return names;
+}
+
+bool VDS1022::apply_preset(const std::string& name, PresetSwitch& result)
+{
+	typedef std::chrono::steady_clock Clock;
+	result = PresetSwitch{};
+	Clock::time_point called = Clock::now();
+
+	std::lock_guard<std::mutex> lock(device_mtx);
+	Clock::time_point locked = Clock::now();
+	Preset* preset = find_preset(name);
+	if(preset == nullptr || replay_open)
+	{
+		return false;
+	}
+
+	if(!driver.push_image(preset->image, result.written))
+	{
+		LogError("Preset %s was not completely written\n", name.c_str());
+		return false;
+	}
+	Clock::time_point pushed = Clock::now();
+
+	config = preset->config;
+	sample_rate = preset->config.sample_rate;
+	generation++;
+
+	result.ranges[0] = preset->image.channel_range[0];
+	result.ranges[1] = preset->image.channel_range[1];
+	result.sample_rate = static_cast<int32_t>(preset->config.sample_rate);
+	result.peak_detect = preset->config.peak_detect != 0;
+	result.roll = preset->config.roll != 0;
+	result.registers = preset->image.count;
+	result.wait_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(locked - called).count());
+	result.push_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(pushed - locked).count());
+	return true;
+}
+
+bool VDS1022::start()
+{
+	return start(own_pipeline);
+}
+
+bool VDS1022::start(FramePipeline& pipeline)
+{
+	if(!opened || running)
+	{
+		return false;
+	}
+
+	active = &pipeline;
+	quit = false;
+	running = true;
+	thread = std::thread(replay_open ? &VDS1022::replay_thread : &VDS1022::acquisition_thread, this);
+	if(!acq_placement.is_default())
+	{
+		acq_placement.apply(thread);
+	}
+	return true;
+}
+
+void VDS1022::stop()
+{
+	if(!running)
+	{
+		return;
+	}
+
+	quit = true;
+	thread.join();
+	running = false;
+
+	// Everything submitted must be through the pipeline before it can go away
+	if(active != &own_pipeline)
+	{
+		active->flush();
+		return;
+	}
+
+	// Nobody will pull the frames still queued
+	std::unique_lock<std::mutex> lock(ready_mtx);
+	while(ready_count > 0)
+	{
+		PipelineFrame* frame = ready[ready_head];
+		ready_head = (ready_head + 1) % ready.size();
+		ready_count--;
+		lock.unlock();
+		own_pipeline.release(frame);
+		lock.lock();
+	}
+}
+
+PipelineFrame* VDS1022::get_frame(unsigned int timeout_ms)
+{
+	std::unique_lock<std::mutex> lock(ready_mtx);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while(ready_count == 0)
+	{
+		if(timeout_ms == 0)
+		{
+			ready_cond.wait(lock);
+		}
+		else if(ready_cond.wait_until(lock, deadline) == std::cv_status::timeout && ready_count == 0)
+		{
+			return nullptr;
+		}
+	}
+
+	PipelineFrame* frame = ready[ready_head];
+	ready_head = (ready_head + 1) % ready.size();
+	ready_count--;
+	return frame;
+}
+
+void VDS1022::release(PipelineFrame* frame)
+{
+	active->release(frame);
+}
+
+bool VDS1022::start_recording(const std::string& path)
+{
+	if(replay_open)
+	{
+		LogError("Can't record while replaying\n");
+		return false;
+	}
+
+	// Same order as the acquisition thread, which records with the device locked
+	std::lock_guard<std::mutex> dlock(device_mtx);
+	std::lock_guard<std::mutex> lock(record_mtx);
+	recorder.close();
+	if(!recorder.open(path))
+	{
+		return false;
+	}
+	record_start = std::chrono::steady_clock::now();
+	recorded_generation = generation;
+	recorder.append_config(config, 0);
+	return true;
+}
+
+void VDS1022::stop_recording()
+{
+	std::lock_guard<std::mutex> lock(record_mtx);
+	recorder.close();
+}
+
+bool VDS1022::is_recording()
+{
+	std::lock_guard<std::mutex> lock(record_mtx);
+	return recorder.is_open();
+}
+
+void VDS1022::get_recording_stats(std::string& path, uint64_t& frames, uint64_t& bytes)
+{
+	std::lock_guard<std::mutex> lock(record_mtx);
+	path = recorder.get_path();
+	frames = recorder.get_frames();
+	bytes = recorder.get_bytes();
+}
+
+bool VDS1022::place_acquisition(const ThreadPlacement& placement)
+{
+	acq_placement = placement;
+	return !running || placement.apply(thread);
+}
+
+void VDS1022::acquisition_thread()
+{
+	typedef AcquisitionTimes::Clock Clock;
+	const Clock::time_point none{};
+	FramePipeline& pipeline = *active;
+
+	// Phases of the acquisition in progress, over as many polls as it takes
+	AcquisitionTimes times{};
+	times.armed = Clock::now();
+	uint32_t armed_generation = generation;
+	while(!quit)
+	{
+		// Blocks while every frame is still being processed or held by the application
+		PipelineFrame* frame = pipeline.acquire(10);
+		if(frame == nullptr)
+		{
+			continue;
+		}
+
+		Driver::DataReadResult result{};
+		{
+			std::lock_guard<std::mutex> lock(device_mtx);
+			// Pushing settings rearms the device
+			if(generation != armed_generation)
+			{
+				armed_generation = generation;
+				times = AcquisitionTimes{};
+				times.armed = Clock::now();
+			}
+			if(probe_phases)
+			{
+				Driver::AcquisitionState state = driver.get_acquisition_state();
+				Clock::time_point now = Clock::now();
+				if(state.triggered && times.triggered == none)
+				{
+					times.triggered = now;
+				}
+				if(state.finished && times.finished == none)
+				{
+					times.finished = now;
+				}
+			}
+
+			Clock::time_point polled = Clock::now();
+			result = driver.get_data(frame->data[0], frame->data[1], 10);
+			frame->roll = driver.is_roll_mode();
+			frame->generation = generation;
+			frame->sample_rate = sample_rate;
+			frame->ranges[0] = driver.get_channel_range(0);
+			frame->ranges[1] = driver.get_channel_range(1);
+			frame->read_time = Clock::now();
+			if(result.kind == Driver::DataReadResult::OKAY)
+			{
+				if(times.finished == none)
+				{
+					times.finished = polled;
+				}
+				times.transferred = frame->read_time;
+				frame->times = times;
+
+				// Read out, so the device starts over
+				times = AcquisitionTimes{};
+				times.armed = frame->read_time;
+
+				// The raw reply is only valid until the next read
+				record_frame(*frame);
+			}
+		}
+
+		if(result.kind == Driver::DataReadResult::OKAY)
+		{
+			frame->has_ch[0] = result.has_ch1;
+			frame->has_ch[1] = result.has_ch2;
+			pipeline.submit(frame);
+			continue;
+		}
+
+		pipeline.release(frame);
+		if(result.kind != Driver::DataReadResult::TIMEOUT)
+		{
+			// Sleep a bit to prevent continuous mutex locking
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+void VDS1022::record_frame(const PipelineFrame& frame)
+{
+	std::lock_guard<std::mutex> lock(record_mtx);
+	if(!recorder.is_open())
+	{
+		return;
+	}
+
+	uint64_t time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.read_time - record_start).count();
+	if(frame.generation != recorded_generation)
+	{
+		recorder.append_config(config, time_ns);
+		recorded_generation = frame.generation;
+	}
+
+	size_t size;
+	const uint8_t* raw = driver.get_raw_data(size);
+	if(!recorder.append_frame(raw, size, frame.roll, time_ns))
+	{
+		LogError("Could not write to %s, recording stopped\n", recorder.get_path().c_str());
+		recorder.close();
+	}
+}
+
+void VDS1022::replay_thread()
+{
+	FramePipeline& pipeline = *active;
+	replay.seek(0);
+	replay_done = false;
+
+	auto start = std::chrono::steady_clock::now();
+	bool first = true;
+	uint64_t first_ns = 0;
+
+	CaptureReader::Record record;
+	while(!quit && replay.next(record))
+	{
+		const CaptureRecordHeader& hdr = *record.header;
+		if(hdr.type == CaptureRecordHeader::CONFIG && hdr.size >= sizeof(CaptureConfig))
+		{
+			std::lock_guard<std::mutex> lock(device_mtx);
+			memcpy(&config, record.payload, sizeof(config));
+			for(auto& range : config.ranges)
+			{
+				range = static_cast<uint8_t>(std::min<size_t>(range, Driver::NUM_RANGES - 1));
+			}
+			replay_roll = config.roll != 0;
+			sample_rate = config.sample_rate;
+			generation++;
+			continue;
+		}
+		if(hdr.type != CaptureRecordHeader::FRAME)
+		{
+			continue;
+		}
+
+		if(replay_realtime)
+		{
+			if(first)
+			{
+				start = std::chrono::steady_clock::now();
+				first_ns = hdr.time_ns;
+				first = false;
+			}
+			// In small steps, so stop() is not held up by gaps in the recording
+			auto due = start + std::chrono::nanoseconds(hdr.time_ns - first_ns);
+			while(!quit)
+			{
+				auto left = due - std::chrono::steady_clock::now();
+				if(left.count() <= 0)
+				{
+					break;
+				}
+				std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(left, std::chrono::milliseconds(10)));
+			}
+		}
+
+		PipelineFrame* frame = nullptr;
+		while(!quit && frame == nullptr)
+		{
+			frame = pipeline.acquire(10);
+		}
+		if(frame == nullptr)
+		{
+			break;
+		}
+
+		Driver::DataReadResult result = driver.decode_data(record.payload, static_cast<int>(hdr.size), frame->data[0], frame->data[1]);
+		frame->roll = hdr.roll != 0;
+		frame->generation = generation;
+		frame->sample_rate = sample_rate;
+		frame->ranges[0] = config.ranges[0];
+		frame->ranges[1] = config.ranges[1];
+		frame->read_time = std::chrono::steady_clock::now();
+		// Only the readout, the recording doesn't have the rest
+		frame->times = AcquisitionTimes{};
+		frame->times.transferred = frame->read_time;
+		if(result.kind != Driver::DataReadResult::OKAY)
+		{
+			pipeline.release(frame);
+			continue;
+		}
+
+		frame->has_ch[0] = result.has_ch1;
+		frame->has_ch[1] = result.has_ch2;
+		pipeline.submit(frame);
+	}
+	replay_done = true;
+}
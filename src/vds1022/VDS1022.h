@@ -0,0 +1,190 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CaptureFile.h"
+#include "Driver.h"
+#include "FramePipeline.h"
+#include "ThreadPlacement.h"
+
+// In-process access to a VDS1022, for applications embedding libvds1022
+// instead of talking to the bridge over SCPI. The bridge itself is built on it.
+//
+// Frames are read by a thread of the library straight into the frames of a
+// FramePipeline, and handed out from there without any copy: the samples are
+// the AcquiredData arrays of the PipelineFrame. Every frame handed out must be
+// given back with release() once done with it, as it can't be reused before.
+// If the application doesn't keep up, acquisition waits for frames to come back.
+//
+// Two ways of getting the frames:
+// - pull: start() without a pipeline, then get_frame() / release()
+// - push: start() with a pipeline of your own, with stages run on every frame
+//   and a deliver callback, which gets the frames in acquisition order
+//
+// Instead of a device, frames may come from a recording made with
+// start_recording(), so everything after the USB reads can be worked on and
+// benchmarked without the hardware.
+class VDS1022
+{
+public:
+	explicit VDS1022(size_t num_frames = 8);
+	~VDS1022();
+
+	// Opens the first VDS1022 found
+	bool open();
+	void close();
+	bool is_open() const { return opened; }
+
+	// Opens a recording in place of a device. Frames come at the pace they were
+	// recorded at if realtime, else as fast as they are processed.
+	bool open_replay(const std::string& path, bool realtime);
+	bool is_replay() const { return replay_open; }
+	// Every frame of the recording was submitted
+	bool is_replay_done() const { return replay_done; }
+
+	// Settings may change while acquiring. Frames carry the generation of the
+	// settings they were acquired with, which changes on every call.
+	// The rate is taken down to one of Driver::SAMPLE_RATES, false if it's
+	// below all of them, when replaying or if the device didn't take it.
+	bool set_sampling(int32_t rate_hz, bool peak_detect, bool roll);
+	bool set_trigger(const TriggerConfig& config);
+	uint32_t get_generation() const { return generation; }
+	uint64_t get_sample_rate() const { return sample_rate; }
+	bool is_roll_mode();
+
+	// Calibrated ranges, see Driver::RANGE_VOLTS_DIV
+	bool set_range(uint8_t ch, size_t range);
+	size_t get_range(uint8_t ch);
+
+	struct AutosetResult
+	{
+		size_t ranges[2];
+		int32_t sample_rate;
+		// 0 if the signal had no whole period
+		double frequency;
+		// Frames read to get there
+		unsigned int acquisitions;
+		bool settled;
+	};
+	// Sets both channels' range and the sample rate to fit the signals. Pauses
+	// acquisition meanwhile, and reads at most max_acquisitions frames.
+	AutosetResult autoset(unsigned int max_acquisitions = 16);
+
+	// Presets are whole setups (ranges with their calibration, sampling and
+	// trigger) compiled to registers once, when stored. Switching to one sends
+	// only the registers differing from what the device has, in a single batch.
+	// Storing takes the current setup, and replaces a preset of the same name.
+	bool store_preset(const std::string& name);
+	bool delete_preset(const std::string& name);
+	std::vector<std::string> get_preset_names();
+
+	struct PresetSwitch
+	{
+		size_t ranges[2];
+		int32_t sample_rate;
+		bool peak_detect;
+		bool roll;
+		// Registers written, out of those the preset has
+		size_t written;
+		size_t registers;
+		// Waiting for the acquisition thread to be done with the device, then
+		// the batch itself
+		uint64_t wait_ns;
+		uint64_t push_ns;
+	};
+	// Acquisition goes on, frames after the switch have a new generation. False
+	// if there's no such preset, or if writing it failed, in which case the
+	// settings are left as they were.
+	bool apply_preset(const std::string& name, PresetSwitch& result);
+
+	bool start();
+	bool start(FramePipeline& pipeline);
+	// Frames not handed out yet are dropped, the others must still be released
+	void stop();
+	bool is_running() const { return running; }
+
+	// Waits up to timeout_ms (0 for ever) for the next frame, nullptr if there's none
+	PipelineFrame* get_frame(unsigned int timeout_ms);
+	// Gives a frame back, whichever way it was obtained
+	void release(PipelineFrame* frame);
+
+	// CPUs and scheduling of the acquisition thread, which does all USB
+	// transfers. Kept for the next start() too.
+	bool place_acquisition(const ThreadPlacement& placement);
+
+	// Polls the trigger and record state between reads, so that frames carry
+	// when they were triggered and complete (see AcquisitionTimes). This adds
+	// USB round trips, and so dead time, to every poll.
+	void set_phase_probing(bool probe) { probe_phases = probe; }
+	bool is_phase_probing() const { return probe_phases; }
+
+	// Appends every frame read, as it comes from the device, to a capture file.
+	// May be started and stopped while acquiring.
+	bool start_recording(const std::string& path);
+	void stop_recording();
+	bool is_recording();
+	// Frames and bytes recorded so far
+	void get_recording_stats(std::string& path, uint64_t& frames, uint64_t& bytes);
+
+	// For anything not wrapped here, hold the lock while using the driver
+	Driver& get_driver() { return driver; }
+	std::mutex& get_device_mutex() { return device_mtx; }
+
+protected:
+
+	void acquisition_thread();
+	void replay_thread();
+	void record_frame(const PipelineFrame& frame);
+
+	Driver driver;
+	bool opened;
+	std::mutex device_mtx;
+
+	// Settings as last pushed, for the recordings. Under device_mtx.
+	CaptureConfig config;
+
+	struct Preset
+	{
+		std::string name;
+		CaptureConfig config;
+		Driver::RegisterImage image;
+	};
+	// Under device_mtx
+	std::vector<Preset> presets;
+	Preset* find_preset(const std::string& name);
+
+	std::mutex record_mtx;
+	CaptureWriter recorder;
+	std::chrono::steady_clock::time_point record_start;
+	uint32_t recorded_generation;
+
+	CaptureReader replay;
+	bool replay_open;
+	bool replay_realtime;
+	bool replay_roll;
+	std::atomic<bool> replay_done;
+
+	std::atomic<uint32_t> generation;
+	std::atomic<uint64_t> sample_rate;
+	std::atomic<bool> probe_phases;
+
+	std::thread thread;
+	ThreadPlacement acq_placement;
+	std::atomic<bool> running;
+	std::atomic<bool> quit;
+	FramePipeline* active;
+
+	// Used for pulling, frames are queued until get_frame()
+	FramePipeline own_pipeline;
+	std::mutex ready_mtx;
+	std::condition_variable ready_cond;
+	std::vector<PipelineFrame*> ready;
+	size_t ready_head;
+	size_t ready_count;
+};
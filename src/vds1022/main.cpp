@@ -1,9 +1,13 @@
-#include <libusb.h>
 #include <iostream>
 #include <string>
 
-#include "Driver.h"
+#include "Benchmark.h"
+#include "BufferPool.h"
 #include "OWONSCPIServer.h"
+#include "ScpiCommands.h"
+#include "TaskPool.h"
+#include "ThreadPlacement.h"
+#include "VDS1022.h"
 
 using namespace std;
 
@@ -16,11 +20,29 @@ void help()
 			"\n"
 			"  [general options]:\n"
 			"    --help                        : this message...\n"
+			"    --benchmark <name>|all        : run processing benchmarks without a device and exit\n"
+			"                                    (fft, pipeline, scpi, replay:<file>)\n"
+			"    --record <file>               : record every frame read from the device to a capture file\n"
+			"    --replay <file>               : serve frames from a capture file instead of a device\n"
+			"    --replay-speed 1|max          : replay at the recorded pace (default) or as fast as possible\n"
+			"    --deadtime-sweep <ms>         : acquire for ms with every sample rate and peak mode, print\n"
+			"                                    the dead time and waveform rate of each and exit\n"
+			"    --probe-phases                : poll the trigger and record state between reads, to time\n"
+			"                                    every phase of an acquisition (adds USB round trips)\n"
 			"\n"
 			"  [bridge options]:\n"
 			"    --scpi-port                   : set port for scpi, default 5025...\n"
 			"    --waveform-port               : set port for waveforms, default 5026...\n"
 			"\n"
+			"  [thread options]:\n"
+			"    placement is <cpus>[,other|fifo|rr[,<priority>]], cpus as 2, 0-3, 1+5 or any\n"
+			"    --acq-thread <placement>      : USB acquisition thread\n"
+			"    --worker-threads <placement>  : pipeline workers (which also write to the sockets),\n"
+			"                                    each pinned to one of the cpus in turn\n"
+			"    --scpi-thread <placement>     : SCPI command thread\n"
+			"    --mlock                       : lock all memory, so frame buffers never page fault\n"
+			"    --hugepages                   : back frame and transfer buffers with 2 MB hugepages\n"
+			"\n"
 			"  [logger options]:\n"
 			"    levels: ERROR, WARNING, NOTICE, VERBOSE, DEBUG\n"
 			"    --quiet|-q                    : reduce logging level by one step\n"
@@ -39,6 +61,18 @@ int main(int argc, char* argv[])
 	uint16_t scpiPort = 5025;
 	uint16_t waveformPort = 5026;
 
+	ThreadPlacement acq_placement;
+	ThreadPlacement worker_placement;
+	ThreadPlacement scpi_placement;
+	bool lock_memory = false;
+
+	string benchmark;
+	string record_path;
+	string replay_path;
+	bool replay_realtime = true;
+	unsigned int sweep_ms = 0;
+	bool probe_phases = false;
+
 	Severity console_verbosity = Severity::NOTICE;
 	for(int i = 1; i < argc; i++)
 	{
@@ -52,6 +86,55 @@ int main(int argc, char* argv[])
 			help();
 			return 0;
 		}
+		else if(s == "--benchmark" && i + 1 < argc)
+		{
+			benchmark = argv[++i];
+		}
+		else if((s == "--acq-thread" || s == "--worker-threads" || s == "--scpi-thread") && i + 1 < argc)
+		{
+			ThreadPlacement& placement = s == "--acq-thread" ? acq_placement :
+				(s == "--worker-threads" ? worker_placement : scpi_placement);
+			if(!placement.parse(argv[++i]))
+			{
+				fprintf(stderr, "Invalid thread placement \"%s\", use --help\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(s == "--record" && i + 1 < argc)
+		{
+			record_path = argv[++i];
+		}
+		else if(s == "--replay" && i + 1 < argc)
+		{
+			replay_path = argv[++i];
+		}
+		else if(s == "--replay-speed" && i + 1 < argc)
+		{
+			string speed(argv[++i]);
+			replay_realtime = speed != "max";
+		}
+		else if(s == "--deadtime-sweep" && i + 1 < argc)
+		{
+			uint64_t ms;
+			if(!scpi_parse_uint(argv[++i], ms, 1, UINT32_MAX))
+			{
+				fprintf(stderr, "Invalid dead time sweep duration \"%s\", use --help\n", argv[i]);
+				return -1;
+			}
+			sweep_ms = static_cast<unsigned int>(ms);
+		}
+		else if(s == "--probe-phases")
+		{
+			probe_phases = true;
+		}
+		else if(s == "--mlock")
+		{
+			lock_memory = true;
+		}
+		else if(s == "--hugepages")
+		{
+			BufferPool::use_huge_pages(true);
+		}
 		else
 		{
 			fprintf(stderr, "Unrecognized command-line argument \"%s\", use --help\n", s.c_str());
@@ -60,28 +143,65 @@ int main(int argc, char* argv[])
 
 	g_log_sinks.emplace(g_log_sinks.begin(), new STDLogSink(console_verbosity));
 
-	int r = libusb_init_context(nullptr, nullptr, 0);
-	if(r < 0)
+	// Once errors can be logged
+	if(!benchmark.empty())
 	{
-		LogError("Unable to initialize libusb\n");
-		return r;
+		if(!run_benchmark(benchmark))
+		{
+			fprintf(stderr, "Benchmark \"%s\" is unknown or failed, use --help\n", benchmark.c_str());
+			return -1;
+		}
+		return 0;
 	}
 
-	Driver driver;
-	if(!driver.init_findany())
+	if(lock_memory)
+	{
+		ThreadPlacement::lock_memory(true);
+	}
+	if(!worker_placement.is_default())
+	{
+		TaskPool::get().place_workers(worker_placement);
+	}
+	if(!scpi_placement.is_default())
+	{
+		scpi_placement.apply_current();
+	}
+
+	VDS1022 scope;
+	if(!replay_path.empty())
+	{
+		if(!scope.open_replay(replay_path, replay_realtime))
+		{
+			LogError("Unable to open %s for replay\n", replay_path.c_str());
+			return -1;
+		}
+	}
+	else if(!scope.open())
 	{
 		LogError("Unable to initialize driver\n");
 		return -1;
 	}
+	if(!record_path.empty() && !scope.start_recording(record_path))
+	{
+		LogError("Unable to record to %s\n", record_path.c_str());
+		return -1;
+	}
+	scope.place_acquisition(acq_placement);
+	scope.set_phase_probing(probe_phases);
 
 	TriggerConfig tconfig;
 	tconfig.kind = TriggerConfig::SINGLE_A;
 	tconfig.channel_config[0].condition = TriggerConfig::ChannelConfig::RISE;
-	driver.push_trigger_config(tconfig);
-	for(int i = 0; i < 1000; i++)
+	if(!scope.is_replay() && !scope.set_trigger(tconfig))
 	{
-        driver.get_data();
-		usleep(100000);
+		return -1;
+	}
+
+	if(sweep_ms > 0)
+	{
+		bool ok = run_dead_time_sweep(scope, sweep_ms);
+		scope.close();
+		return ok ? 0 : -1;
 	}
 
 	Socket scpiSocket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
@@ -114,15 +234,13 @@ int main(int argc, char* argv[])
 
 		LogNotice("Connected, starting operation!\n");
 
-		OWONSCPIServer server(scpiClient.Detach(), std::move(dataClient), &driver);
-
 		// Launch the waveform obtainer thread
+		OWONSCPIServer server(scpiClient.Detach(), std::move(dataClient), &scope);
 
 		server.MainLoop();
 	}
 
-	driver.deinit();
-	libusb_exit(nullptr);
+	scope.close();
 
 	return 0;
 